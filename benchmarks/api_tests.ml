@@ -0,0 +1,65 @@
+(* SPDX-License-Identifier: MIT *)
+(* Behaviour tests of the C API of Boxroot, see api_tests_stubs.c.
+   The tests are run in order, and stop at the first failure. *)
+
+type custom
+external custom_first : unit -> custom = "api_test_custom_first"
+external custom_get : custom -> float = "api_test_custom_get"
+external custom_set : custom -> float -> unit = "api_test_custom_set"
+external create : unit -> unit = "api_test_create"
+external migrate_create : unit -> unit = "api_test_migrate_create"
+external migrate_take : unit -> unit = "api_test_migrate_take"
+external group : unit -> unit = "api_test_group"
+external group_create : unit -> unit = "api_test_group_create"
+external group_remote : unit -> unit = "api_test_group_remote"
+external array : unit -> unit = "api_test_array"
+external cell_register : unit -> unit = "api_test_cell_register"
+external cell_unregister : unit -> unit = "api_test_cell_unregister"
+external compact : unit -> unit = "api_test_compact"
+external weak : unit -> unit = "api_test_weak"
+external permanent : unit -> unit = "api_test_permanent"
+external reserve : unit -> unit = "api_test_reserve"
+external hard_limit : unit -> unit = "api_test_hard_limit"
+
+let () =
+  Callback.register "api_tests.minor_gc" Gc.minor;
+  Callback.register "api_tests.major_gc" Gc.full_major
+
+let on_other_domain f = Domain.join (Domain.spawn f)
+
+let check name b = if not b then failwith (name ^ ": check failed")
+
+let custom () =
+  let b = custom_first () in
+  Gc.minor ();
+  check "custom" (custom_get b = 1.);
+  (* a young float, rather than a constant *)
+  custom_set b (Float.of_string "2.");
+  Gc.full_major ();
+  check "custom" (custom_get b = 2.);
+  (* [b] is unreachable from now on: its root is deleted by a later
+     major slice. *)
+  Gc.full_major ()
+
+let tests = [
+  (* First, to allocate a custom block before any other call to Boxroot *)
+  "custom", custom;
+  "create", create;
+  "migrate", (fun () -> migrate_create (); on_other_domain migrate_take);
+  "group", group;
+  "group_remote", (fun () ->
+    group_create (); on_other_domain group_remote; Gc.full_major ());
+  "array", array;
+  "cell", (fun () ->
+    cell_register (); on_other_domain cell_unregister; Gc.full_major ());
+  "compact", compact;
+  "weak", weak;
+  "permanent", permanent;
+  "reserve", reserve;
+  "hard_limit", hard_limit;
+]
+
+let () =
+  tests |> List.iter (fun (name, test) ->
+    test ();
+    Printf.printf "%s: ok\n%!" name)
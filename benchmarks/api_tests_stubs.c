@@ -0,0 +1,405 @@
+/* SPDX-License-Identifier: MIT */
+#define CAML_NAME_SPACE
+#include <caml/mlvalues.h>
+#include <caml/memory.h>
+#include <caml/alloc.h>
+#include <caml/fail.h>
+#include <caml/callback.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../boxroot/boxroot.h"
+
+/* Behaviour tests of the C API of Boxroot, called from api_tests.ml.
+   A failed check raises Failure with its location.
+
+   The values under test are floats, allocated young: the checks below
+   read them back after they have been promoted by a minor collection,
+   then moved or not by a major collection. Nothing else keeps them
+   alive, which is the point of the tests. */
+
+#define check(cond) do {                                        \
+    if (!(cond)) check_failed(__LINE__, #cond);                 \
+  } while (0)
+
+static void check_failed(int line, char const *cond)
+{
+  char msg[256];
+  snprintf(msg, sizeof(msg), "api_tests_stubs.c:%d: check failed: %s",
+           line, cond);
+  caml_failwith(msg);
+}
+
+/* Gc.minor and Gc.full_major, registered by api_tests.ml */
+static void minor_gc(void)
+{
+  caml_callback(*caml_named_value("api_tests.minor_gc"), Val_unit);
+}
+
+static void major_gc(void)
+{
+  caml_callback(*caml_named_value("api_tests.major_gc"), Val_unit);
+}
+
+#define NUM_ROOTS 10000
+
+/* Enough roots to span several pools */
+value api_test_create(value unit)
+{
+  static boxroot r[NUM_ROOTS];
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    r[i] = boxroot_create(caml_copy_double(i));
+    check(r[i] != NULL);
+  }
+  minor_gc();
+  for (int i = 0; i < NUM_ROOTS; i++)
+    check(Double_val(boxroot_get(r[i])) == i);
+  /* Store young values into old roots, and delete every other root */
+  for (int i = 0; i < NUM_ROOTS; i += 2) {
+    boxroot_delete(r[i]);
+    check(boxroot_modify(&r[i + 1], caml_copy_double(-i)));
+  }
+  minor_gc();
+  major_gc();
+  for (int i = 1; i < NUM_ROOTS; i += 2) {
+    check(Double_val(boxroot_get(r[i])) == 1 - i);
+    check(*boxroot_get_ref(r[i]) == boxroot_get(r[i]));
+    check(boxroot_modify(&r[i], Val_int(i)));
+  }
+  major_gc();
+  for (int i = 1; i < NUM_ROOTS; i += 2) {
+    check(boxroot_get(r[i]) == Val_int(i));
+    boxroot_delete(r[i]);
+  }
+  return Val_unit;
+}
+
+/* A root created by one domain, then migrated to and deleted by
+   another one */
+static boxroot migrated = NULL;
+
+value api_test_migrate_create(value unit)
+{
+  migrated = boxroot_create(caml_copy_double(1.));
+  check(migrated != NULL);
+  return Val_unit;
+}
+
+value api_test_migrate_take(value unit)
+{
+  check(migrated != NULL);
+  check(boxroot_migrate(&migrated));
+  check(Double_val(boxroot_get(migrated)) == 1.);
+  /* Migrating again does nothing */
+  boxroot r = migrated;
+  check(boxroot_migrate(&migrated));
+  check(migrated == r);
+  check(boxroot_modify(&migrated, caml_copy_double(2.)));
+  minor_gc();
+  major_gc();
+  check(Double_val(boxroot_get(migrated)) == 2.);
+  boxroot_delete(migrated);
+  migrated = NULL;
+  return Val_unit;
+}
+
+/* Roots of a group, in several pools, released at once. The group
+   keeps its values alive until then. */
+value api_test_group(value unit)
+{
+  static boxroot r[NUM_ROOTS];
+  boxroot_group g = boxroot_group_create();
+  check(g != NULL);
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    r[i] = boxroot_create_in(g, caml_copy_double(i));
+    check(r[i] != NULL);
+  }
+  /* The slot of a deleted root of the pool being filled is reused */
+  boxroot_delete(r[NUM_ROOTS - 1]);
+  boxroot last = boxroot_create_in(g, caml_copy_double(NUM_ROOTS - 1));
+  check(last == r[NUM_ROOTS - 1]);
+  minor_gc();
+  major_gc();
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    check(Double_val(boxroot_get(r[i])) == i);
+    /* Old pools of the group accept young values again */
+    check(boxroot_modify(&r[i], caml_copy_double(-i)));
+  }
+  minor_gc();
+  for (int i = 0; i < NUM_ROOTS; i++)
+    check(Double_val(boxroot_get(r[i])) == -i);
+  boxroot_group_release(g);
+  /* The pools of the group go back to the domain */
+  major_gc();
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    r[i] = boxroot_create(caml_copy_double(i));
+    check(r[i] != NULL);
+  }
+  minor_gc();
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    check(Double_val(boxroot_get(r[i])) == i);
+    boxroot_delete(r[i]);
+  }
+  return Val_unit;
+}
+
+/* A group can only be filled by its own domain */
+static boxroot_group shared_group = NULL;
+
+value api_test_group_create(value unit)
+{
+  shared_group = boxroot_group_create();
+  check(shared_group != NULL);
+  check(boxroot_create_in(shared_group, caml_copy_double(1.)) != NULL);
+  return Val_unit;
+}
+
+value api_test_group_remote(value unit)
+{
+#if OCAML_MULTICORE
+  errno = 0;
+  check(boxroot_create_in(shared_group, Val_unit) == NULL);
+  check(errno == EPERM);
+#endif
+  /* Released at the next collection of its domain */
+  boxroot_group_release(shared_group);
+  shared_group = NULL;
+  return Val_unit;
+}
+
+/* Arrays keep their elements across collections and resizes */
+value api_test_array(value unit)
+{
+  boxroot_array a = boxroot_array_create(4);
+  check(a != NULL);
+  check(boxroot_array_size(a) == 4);
+  for (size_t i = 0; i < 4; i++) {
+    check(boxroot_array_get(a, i) == Val_unit);
+    check(boxroot_array_set(a, i, caml_copy_double(i)));
+  }
+  minor_gc();
+  /* Grow: the new elements are Val_unit */
+  check(boxroot_array_resize(&a, NUM_ROOTS));
+  check(boxroot_array_size(a) == NUM_ROOTS);
+  for (size_t i = 0; i < NUM_ROOTS; i++) {
+    if (i < 4) check(Double_val(boxroot_array_get(a, i)) == i);
+    else check(boxroot_array_get(a, i) == Val_unit);
+    check(boxroot_array_set(a, i, caml_copy_double(-(double)i)));
+  }
+  minor_gc();
+  major_gc();
+  for (size_t i = 0; i < NUM_ROOTS; i++) {
+    check(Double_val(boxroot_array_get(a, i)) == -(double)i);
+    check(*boxroot_array_get_ref(a, i) == boxroot_array_get(a, i));
+  }
+  /* Shrink, then store young values again */
+  check(boxroot_array_resize(&a, 2));
+  check(boxroot_array_size(a) == 2);
+  check(Double_val(boxroot_array_get(a, 1)) == -1.);
+  check(boxroot_array_set(a, 0, caml_copy_double(42.)));
+  minor_gc();
+  major_gc();
+  check(Double_val(boxroot_array_get(a, 0)) == 42.);
+  check(Double_val(boxroot_array_get(a, 1)) == -1.);
+  boxroot_array_delete(a);
+  return Val_unit;
+}
+
+/* Cells embedded in a C structure, unregistered by another domain
+   than the one that registered them */
+struct node {
+  int id;
+  boxroot_cell cell;
+};
+
+static struct node *nodes = NULL;
+
+value api_test_cell_register(value unit)
+{
+  nodes = malloc(NUM_ROOTS * sizeof(struct node));
+  check(nodes != NULL);
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    nodes[i].id = i;
+    check(boxroot_cell_register(&nodes[i].cell, caml_copy_double(i)));
+  }
+  minor_gc();
+  for (int i = 0; i < NUM_ROOTS; i += 2)
+    check(boxroot_cell_set(&nodes[i].cell, caml_copy_double(-i)));
+  minor_gc();
+  major_gc();
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    double expected = i % 2 == 0 ? -i : i;
+    check(Double_val(boxroot_cell_get(&nodes[i].cell)) == expected);
+    check(*boxroot_cell_get_ref(&nodes[i].cell)
+          == boxroot_cell_get(&nodes[i].cell));
+  }
+  return Val_unit;
+}
+
+value api_test_cell_unregister(value unit)
+{
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    check(nodes[i].id == i);
+    check(boxroot_cell_get(&nodes[i].cell) != Val_unit);
+#if OCAML_MULTICORE
+    /* Young values can only be stored by the domain of the cell */
+    errno = 0;
+    check(!boxroot_cell_set(&nodes[i].cell, caml_copy_double(0.)));
+    check(errno == EPERM);
+#endif
+    boxroot_cell_unregister(&nodes[i].cell);
+  }
+  /* The memory of the cells can be reused right away */
+  free(nodes);
+  nodes = NULL;
+  minor_gc();
+  major_gc();
+  return Val_unit;
+}
+
+/* Compact handles round-trip to their root, over several pools */
+value api_test_compact(value unit)
+{
+  static boxroot_compact h[NUM_ROOTS];
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    h[i] = boxroot_compact_create(caml_copy_double(i));
+    check(h[i] != 0);
+  }
+  minor_gc();
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    check(Double_val(boxroot_compact_get(h[i])) == i);
+    check(*boxroot_compact_get_ref(h[i]) == boxroot_compact_get(h[i]));
+    /* Young values into old roots, possibly moving them */
+    check(boxroot_compact_modify(&h[i], caml_copy_double(-i)));
+    check(h[i] != 0);
+  }
+  minor_gc();
+  major_gc();
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    check(Double_val(boxroot_compact_get(h[i])) == -i);
+    boxroot_compact_delete(h[i]);
+  }
+  return Val_unit;
+}
+
+/* Weak roots are cleared once their value dies, and only then */
+value api_test_weak(value unit)
+{
+  boxroot keep = boxroot_create(caml_copy_double(1.));
+  check(keep != NULL);
+  boxroot_weak live = boxroot_weak_create(boxroot_get(keep));
+  boxroot_weak dead = boxroot_weak_create(caml_copy_double(2.));
+  boxroot_weak imm = boxroot_weak_create(Val_int(3));
+  check(live != NULL && dead != NULL && imm != NULL);
+  /* Young values are kept until their promotion */
+  check(Double_val(boxroot_weak_get(dead)) == 2.);
+  minor_gc();
+  /* Reading the value during marking keeps it alive until the end of
+     the cycle: collect twice. */
+  major_gc();
+  major_gc();
+  check(boxroot_weak_get(dead) == BOXROOT_WEAK_EMPTY);
+  check(boxroot_weak_get(live) == boxroot_get(keep));
+  check(Double_val(boxroot_weak_get(live)) == 1.);
+  check(boxroot_weak_get(imm) == Val_int(3));
+  boxroot_delete(keep);
+  boxroot_weak_delete(live);
+  boxroot_weak_delete(dead);
+  boxroot_weak_delete(imm);
+  return Val_unit;
+}
+
+/* Permanent roots keep their value until teardown */
+value api_test_permanent(value unit)
+{
+  static boxroot_permanent r[NUM_ROOTS];
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    r[i] = boxroot_create_permanent(caml_copy_double(i));
+    check(r[i] != NULL);
+  }
+  minor_gc();
+  major_gc();
+  /* Permanent pools are only scanned once per major cycle */
+  major_gc();
+  for (int i = 0; i < NUM_ROOTS; i++)
+    check(Double_val(boxroot_permanent_get(r[i])) == i);
+  return Val_unit;
+}
+
+/* Creations within a reservation do not allocate pools: they succeed
+   even when no new pool can be allocated. */
+value api_test_reserve(value unit)
+{
+  static boxroot r[NUM_ROOTS];
+  check(boxroot_reserve(NUM_ROOTS));
+  boxroot_set_memory_limits(0, 1, NULL);
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    r[i] = boxroot_create(caml_copy_double(i));
+    check(r[i] != NULL);
+  }
+  boxroot_set_memory_limits(0, 0, NULL);
+  minor_gc();
+  for (int i = 0; i < NUM_ROOTS; i++) {
+    check(Double_val(boxroot_get(r[i])) == i);
+    boxroot_delete(r[i]);
+  }
+  return Val_unit;
+}
+
+/* Once the hard limit is reached, creations fail with ENOMEM after
+   the free slots are used up. */
+value api_test_hard_limit(value unit)
+{
+  size_t capacity = NUM_ROOTS, n = 0;
+  boxroot *r = malloc(capacity * sizeof(boxroot));
+  check(r != NULL);
+  boxroot_set_memory_limits(0, 1, NULL);
+  for (;;) {
+    if (n == capacity) {
+      /* The free slots of the domain must run out at some point */
+      check(capacity < ((size_t)1 << 24));
+      capacity *= 2;
+      r = realloc(r, capacity * sizeof(boxroot));
+      check(r != NULL);
+    }
+    errno = 0;
+    boxroot new_root = boxroot_create(Val_unit);
+    if (new_root == NULL) break;
+    r[n++] = new_root;
+  }
+  check(errno == ENOMEM);
+  check(boxroot_status() == BOXROOT_RUNNING);
+  /* Without limit, creations succeed again */
+  boxroot_set_memory_limits(0, 0, NULL);
+  boxroot last = boxroot_create(Val_unit);
+  check(last != NULL);
+  boxroot_delete(last);
+  boxroot_delete_many(r, n);
+  free(r);
+  return Val_unit;
+}
+
+/* Custom blocks, allocated before any other call to Boxroot: Boxroot
+   is set up by boxroot_custom_alloc. */
+value api_test_custom_first(value unit)
+{
+  CAMLparam0();
+  CAMLlocal1(b);
+  check(boxroot_status() == BOXROOT_NOT_SETUP);
+  b = boxroot_custom_alloc(caml_copy_double(1.));
+  check(boxroot_status() == BOXROOT_RUNNING);
+  check(*boxroot_custom_root(b) != NULL);
+  CAMLreturn(b);
+}
+
+value api_test_custom_get(value b)
+{
+  return boxroot_get(*boxroot_custom_root(b));
+}
+
+value api_test_custom_set(value b, value v)
+{
+  check(boxroot_modify(boxroot_custom_root(b), v));
+  return Val_unit;
+}
@@ -0,0 +1,69 @@
+(* SPDX-License-Identifier: MIT *)
+(* Spawn and join short-lived domains repeatedly. Each of them
+   allocates roots that outlive it, so that its pools are orphaned
+   when it terminates. Meanwhile, long-lived domains allocate
+   continuously and trigger minor collections. Ideally the pools of
+   terminated domains end up spread across the surviving domains,
+   rather than scanned by a single one which then becomes the
+   straggler of every parallel minor collection (look at the peak
+   minor collection time with STATS=1).
+
+   make -C .. benchmarks/domain_churn.exe \
+   && REF=boxroot N=100 DOMS=4 ROOTS=100_000 ./domain_churn.exe
+*)
+
+let getenv_int var =
+  try int_of_string (Sys.getenv var)
+  with _ ->
+    Printf.ksprintf failwith "We expected an environment variable %s with an integer value." var
+
+let n = getenv_int "N"
+let doms = getenv_int "DOMS"
+let roots = getenv_int "ROOTS"
+
+module Config = Ref.Config
+module Root = Config.Ref
+
+(* Allocate roots from a fresh domain which terminates right away. *)
+let spawn_roots round =
+  Domain.join (Domain.spawn (fun () ->
+    Array.init roots (fun i -> Root.create (round, i))))
+
+let check_and_delete round a =
+  Array.iteri (fun i r ->
+    assert (Root.get r = (round, i));
+    Root.delete r) a
+
+(* Allocate young roots until [stop] is set, in order to trigger
+   minor collections. *)
+let worker stop () =
+  let count = ref 0 in
+  while not (Atomic.get stop) do
+    let r = Root.create (ref !count) in
+    ignore (Sys.opaque_identity (Root.get r));
+    Root.delete r;
+    incr count
+  done;
+  !count
+
+let () =
+  Root.setup ();
+  Printf.printf "%s: %!" Config.implem_name;
+  let before = Ref.Time.time () in
+  let stop = Atomic.make false in
+  let workers = List.init (doms - 1) (fun _ -> Domain.spawn (worker stop)) in
+  (* Keep the roots of the last two rounds alive. *)
+  let prev = ref (spawn_roots 0) in
+  for round = 1 to n - 1 do
+    let a = spawn_roots round in
+    check_and_delete (round - 1) !prev;
+    prev := a
+  done;
+  check_and_delete (n - 1) !prev;
+  Atomic.set stop true;
+  List.iter (fun d -> ignore (Domain.join d)) workers;
+  let after = Ref.Time.time () in
+  Printf.printf "%.2fs\n%!" (after -. before);
+  if Config.show_stats then
+    Root.print_stats ();
+  Root.teardown ();
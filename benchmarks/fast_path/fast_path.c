@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: MIT */
+/* The loop timed by main.c. It is either linked into the program or
+   into a shared object together with its own copy of Boxroot, as a
+   plugin would. */
+#define CAML_NAME_SPACE
+#include <caml/mlvalues.h>
+#include "boxroot.h"
+
+#define ROOTS 1000
+
+/* Create, modify, read and delete [ROOTS] boxroots, [rounds] times.
+   Return a sum of the values read so that the loop is not optimised
+   away, or -1 if an allocation failed. */
+__attribute__((visibility("default")))
+long fast_path_run(long rounds)
+{
+  static boxroot roots[ROOTS];
+  long sum = 0;
+  for (long k = 0; k < rounds; k++) {
+    for (int i = 0; i < ROOTS; i++) {
+      roots[i] = boxroot_create(Val_long(i));
+      if (roots[i] == NULL) return -1;
+    }
+    for (int i = 0; i < ROOTS; i++) {
+      boxroot_modify(&roots[i], Val_long(k));
+      sum += Long_val(boxroot_get(roots[i]));
+    }
+    for (int i = 0; i < ROOTS; i++) boxroot_delete(roots[i]);
+  }
+  return sum;
+}
+
+/* Modify [ROOTS] boxroots [rounds] times, to isolate the cost of the
+   fast path of boxroot_modify. The roots stay in young pools, since
+   no minor collection happens during the loop. */
+__attribute__((visibility("default")))
+long fast_path_modify_run(long rounds)
+{
+  static boxroot roots[ROOTS];
+  long sum = 0;
+  for (int i = 0; i < ROOTS; i++) {
+    roots[i] = boxroot_create(Val_long(i));
+    if (roots[i] == NULL) return -1;
+  }
+  for (long k = 0; k < rounds; k++) {
+    for (int i = 0; i < ROOTS; i++) {
+      if (!boxroot_modify(&roots[i], Val_long(k))) return -1;
+    }
+  }
+  for (int i = 0; i < ROOTS; i++) {
+    sum += Long_val(boxroot_get(roots[i]));
+    boxroot_delete(roots[i]);
+  }
+  return sum;
+}
@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: MIT */
+/* Measure the cost of the fast paths of Boxroot (create, modify, get
+   and delete, then modify alone), with Boxroot linked statically into
+   the program, or into the shared object given as argument.
+
+   See `make run-fast_path`: the shared objects are built with and
+   without BOXROOT_SHARED_LIBRARY, which should cost the same as the
+   static build. */
+#define CAML_NAME_SPACE
+#include <caml/callback.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+long fast_path_run(long rounds);
+long fast_path_modify_run(long rounds);
+
+#define ROOTS 1000
+
+/* Return the time of [run(rounds)] in ns per root and round, or -1 if
+   an allocation failed. */
+static double time_run(long (*run)(long), long rounds)
+{
+  /* Warm up: allocate the pools */
+  if (run(1) < 0) return -1;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  long res = run(rounds);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (res < 0) return -1;
+  double ns = (end.tv_sec - start.tv_sec) * 1e9
+    + (end.tv_nsec - start.tv_nsec);
+  return ns / ((double)rounds * ROOTS);
+}
+
+int main(int argc, char **argv)
+{
+  long (*run)(long) = NULL;
+  long (*modify_run)(long) = NULL;
+  const char *name = "static";
+#ifdef FAST_PATH_STATIC
+  run = &fast_path_run;
+  modify_run = &fast_path_modify_run;
+#else
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <shared object>\n", argv[0]);
+    return 2;
+  }
+  name = argv[1];
+  void *handle = dlopen(argv[1], RTLD_NOW);
+  if (handle == NULL) {
+    fprintf(stderr, "%s\n", dlerror());
+    return 1;
+  }
+  run = (long (*)(long))dlsym(handle, "fast_path_run");
+  modify_run = (long (*)(long))dlsym(handle, "fast_path_modify_run");
+  if (run == NULL || modify_run == NULL) {
+    fprintf(stderr, "%s\n", dlerror());
+    return 1;
+  }
+#endif
+  char *caml_argv[] = { argv[0], NULL };
+  caml_startup(caml_argv);
+  char *s = getenv("N");
+  long rounds = (s == NULL) ? 100000 : atol(s);
+  double ns = time_run(run, rounds);
+  double modify_ns = time_run(modify_run, rounds);
+  if (ns < 0 || modify_ns < 0) {
+    fprintf(stderr, "allocation failure\n");
+    return 1;
+  }
+  printf("%s: %.2f ns per create+modify+get+delete, %.2f ns per modify\n",
+         name, ns, modify_ns);
+  caml_shutdown();
+  return 0;
+}
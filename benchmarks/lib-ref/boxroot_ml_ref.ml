@@ -0,0 +1,15 @@
+(* SPDX-License-Identifier: MIT *)
+(* Boxroot through the OCaml library in ocaml/ *)
+type 'a t = 'a Boxroot.t
+let create = Boxroot.create
+let get = Boxroot.get
+let modify a i v =
+  (* Roots are immediate: no write barrier *)
+  Array.unsafe_set a i (Boxroot.modify (Array.unsafe_get a i) v)
+let delete = Boxroot.delete
+
+let setup () = ()
+(* Boxroot.teardown is not exposed to OCaml *)
+let teardown () = ()
+
+let print_stats = Boxroot.print_stats
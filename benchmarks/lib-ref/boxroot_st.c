@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: MIT */
+#define BOXROOT_SINGLE_THREADED 1
+#include "../../boxroot/boxroot.h"
+
+/* The prefix is added by gen_boxroot.h */
+typedef boxroot st_boxroot;
+#undef boxroot_create
+#undef boxroot_get
+#undef boxroot_delete
+#undef boxroot_modify
+#undef boxroot_setup
+#undef boxroot_print_stats
+#undef boxroot_teardown
+
+#define MY_PREFIX st_
+#include "gen_boxroot.h"
@@ -0,0 +1,11 @@
+(* SPDX-License-Identifier: MIT *)
+type 'a t
+external create : 'a -> 'a t         = "st_boxroot_ref_create" [@@noalloc]
+external get : 'a t -> 'a            = "st_boxroot_ref_get" [@@noalloc]
+external modify : 'a t array -> int -> 'a -> unit = "st_boxroot_ref_modify" [@@noalloc]
+external delete : 'a t -> unit       = "st_boxroot_ref_delete" [@@noalloc]
+
+external setup : unit -> unit = "st_boxroot_ref_setup"
+external teardown : unit -> unit = "st_boxroot_ref_teardown"
+
+external print_stats : unit -> unit = "st_boxroot_stats"
@@ -30,6 +30,8 @@ let implementations : (string * (module Ref)) list = [
   "global", (module Global_ref);
   "generational", (module Generational_ref);
   "boxroot", (module Boxroot_ref);
+  "boxroot_st", (module Boxroot_st_ref);
+  "boxroot_ml", (module Boxroot_ml_ref);
   "dll_boxroot", (module Dll_boxroot_ref);
   "bitmap_boxroot", (module Bitmap_boxroot_ref);
   "rem_boxroot", (module Rem_boxroot_ref);
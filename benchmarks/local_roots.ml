@@ -24,7 +24,8 @@ let ocaml_ref_fixpoint f x =
   !(ocaml_ref_fixpoint_rec fr xr)
 
 external local_fixpoint : (float -> float) -> float -> float = "local_fixpoint"
-external local_ref_fixpoint : (float -> float) -> float -> float = "local_ref_fixpoint"
+external boxroot_local_fixpoint : (float -> float) -> float -> float = "boxroot_local_fixpoint"
+external boxroot_local_teardown : unit -> unit = "boxroot_local_teardown_caml"
 external naive_fixpoint : (float -> float) -> float -> float = "naive_fixpoint"
 external boxroot_fixpoint : (float -> float) -> float -> float = "boxroot_fixpoint"
 external dll_boxroot_fixpoint : (float -> float) -> float -> float = "dll_boxroot_fixpoint"
@@ -57,10 +58,10 @@ let local = {
   stats = ignore;
 }
 
-let local_ref = {
-  fixpoint = local_ref_fixpoint;
+let boxroot_local = {
+  fixpoint = boxroot_local_fixpoint;
   setup = ignore;
-  teardown = ignore;
+  teardown = boxroot_local_teardown;
   stats = ignore;
 }
 
@@ -129,7 +130,7 @@ let rem_boxroot = {
 
 let implementations = [
   "local", local;
-  "local_ref", local_ref;
+  "boxroot_local", boxroot_local;
   "ocaml", ocaml;
   "ocaml_ref", ocaml_ref;
   "naive", naive;
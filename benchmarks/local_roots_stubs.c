@@ -45,33 +45,43 @@ int compare_refs(value_ref x, value_ref y)
 }
 
 
-/* Using the reap implementation of local refs (OpenJDK-style) */
+/* Using scoped local roots (OpenJDK-style reap) */
 
-#include "../boxroot/arena.h"
+#include "../boxroot/boxroot_local.h"
 
-local_ref local_ref_fixpoint_rooted(local_ref f, local_ref x)
+boxroot_local boxroot_local_fixpoint_rooted(boxroot_local f, boxroot_local x)
 {
-  local_ref y = alloc_local_ref(caml_callback(local_get(f), local_get(x)));
-  if (compare_refs(local_get_ref(x), local_get_ref(y))) {
+  boxroot_local y =
+    boxroot_local_create(caml_callback(boxroot_local_get(f),
+                                       boxroot_local_get(x)));
+  if (y == NULL) caml_failwith("boxroot_local_create");
+  if (compare_refs(boxroot_local_get_ref(x), boxroot_local_get_ref(y))) {
     /* No need to delete x */
     return y;
   } else {
-    delete_local_ref(x);
-    return local_ref_fixpoint_rooted(f, y);
+    boxroot_local_delete(x);
+    return boxroot_local_fixpoint_rooted(f, y);
   }
 }
 
-value local_ref_fixpoint(value f, value x)
+value boxroot_local_fixpoint(value f, value x)
 {
-  arena a;
-  init_arena(&a);
-  local_ref f0 = alloc_local_ref(f);
-  local_ref x0 = alloc_local_ref(x);
-  value res = local_get(local_ref_fixpoint_rooted(f0, x0));
-  drop_arena(&a);
+  boxroot_local_frame frame;
+  boxroot_local_enter(&frame);
+  boxroot_local f0 = boxroot_local_create(f);
+  boxroot_local x0 = boxroot_local_create(x);
+  if (f0 == NULL || x0 == NULL) caml_failwith("boxroot_local_create");
+  value res = boxroot_local_get(boxroot_local_fixpoint_rooted(f0, x0));
+  boxroot_local_leave(&frame);
   return res;
 }
 
+value boxroot_local_teardown_caml(value unit)
+{
+  boxroot_local_teardown();
+  return unit;
+}
+
 
 /* Naive version with boxroots, callee-roots */
 
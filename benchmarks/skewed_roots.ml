@@ -0,0 +1,58 @@
+(* SPDX-License-Identifier: MIT *)
+(* A single domain holds all the roots, which it renews with young
+   values continuously, while the other domains only allocate. Every
+   parallel minor collection then waits for the first domain to scan
+   its young roots. Compare the scaling with and without
+   BOXROOT_SHARED_SCANNING=1.
+
+   make -C .. benchmarks/skewed_roots.exe \
+   && REF=boxroot N=200 DOMS=4 ROOTS=100_000 ./skewed_roots.exe
+*)
+
+let getenv_int var =
+  try int_of_string (Sys.getenv var)
+  with _ ->
+    Printf.ksprintf failwith "We expected an environment variable %s with an integer value." var
+
+let n = getenv_int "N"
+let doms = getenv_int "DOMS"
+let roots = getenv_int "ROOTS"
+
+module Config = Ref.Config
+module Root = Config.Ref
+
+(* Allocate until [stop] is set, in order to trigger minor
+   collections. *)
+let worker stop () =
+  let count = ref 0 in
+  while not (Atomic.get stop) do
+    ignore (Sys.opaque_identity (ref !count));
+    incr count
+  done;
+  !count
+
+let run () =
+  let a = Array.init roots (fun i -> Root.create (ref i)) in
+  for round = 1 to n do
+    for i = 0 to roots - 1 do
+      assert (!(Root.get a.(i)) = i + round - 1);
+      Root.delete a.(i);
+      a.(i) <- Root.create (ref (i + round))
+    done
+  done;
+  Array.iter Root.delete a
+
+let () =
+  Root.setup ();
+  Printf.printf "%s (%d domains): %!" Config.implem_name doms;
+  let stop = Atomic.make false in
+  let workers = List.init (doms - 1) (fun _ -> Domain.spawn (worker stop)) in
+  let before = Ref.Time.time () in
+  run ();
+  let after = Ref.Time.time () in
+  Atomic.set stop true;
+  List.iter (fun d -> ignore (Domain.join d)) workers;
+  Printf.printf "%.2fs\n%!" (after -. before);
+  if Config.show_stats then
+    Root.print_stats ();
+  Root.teardown ();
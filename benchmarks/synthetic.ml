@@ -16,6 +16,11 @@ GC_PROMOTION_RATE=0.1 \
 GC_SURVIVAL_RATE=0.5 \
 ./benchmarks/synthetic.exe
 
+The parameters of Boxroot can be set in the same way (see
+boxroot_configure in boxroot.h), e.g. BOXROOT_POOL_LOG_SIZE=12. The
+target run-synthetic-sweep of the Makefile compares the values of a
+parameter on two workloads.
+
 *)
 
 let wrong_usage () =
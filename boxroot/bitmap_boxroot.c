@@ -601,7 +601,7 @@ int bitmap_boxroot_setup()
   stats = empty_stats;
   rings.young = NULL;
   rings.old = NULL;
-  bxr_setup_hooks(&scanning_callback, NULL);
+  bxr_setup_hooks(&scanning_callback, NULL, NULL, NULL);
   // we are done
   setup = 1;
   if (BOXROOT_DEBUG) validate_all_rings();
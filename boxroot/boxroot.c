@@ -9,7 +9,9 @@
 #include <stdarg.h>
 #include <stdalign.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -17,6 +19,9 @@
 #define CAML_INTERNALS
 
 #include "boxroot.h"
+#include <caml/custom.h>
+#include <caml/fail.h>
+#include <caml/memory.h>
 #include <caml/minor_gc.h>
 #include <caml/major_gc.h>
 
@@ -31,6 +36,44 @@
 static_assert(!BXR_FORCE_REMOTE || BXR_MULTITHREAD,
               "invalid configuration");
 
+/* Let idle domains help scanning the young pools of other domains
+   during minor collections? (OCaml 5 only, experimental)
+   This can be enabled by passing BOXROOT_SHARED_SCANNING=1 as
+   argument. It stays disabled by default until it has been measured
+   with several domains (make run-skewed_roots). */
+#ifndef BOXROOT_SHARED_SCANNING
+#define BOXROOT_SHARED_SCANNING false
+#endif
+
+#define SHARED_SCANNING (BOXROOT_SHARED_SCANNING && OCAML_MULTICORE)
+
+/* Darken old pools during the first major slices instead of at the
+   start of the major cycle? (OCaml 5 only, experimental)
+   This can be enabled by passing BOXROOT_CONCURRENT_MARKING=1 as
+   argument. */
+#ifndef BOXROOT_CONCURRENT_MARKING
+#define BOXROOT_CONCURRENT_MARKING false
+#endif
+
+#define CONCURRENT_MARKING (BOXROOT_CONCURRENT_MARKING && OCAML_MULTICORE)
+
+/* Default bounds on the number of empty pools kept by each domain at
+   major collection, beyond its reserved pools. Within the bounds, the
+   number kept follows the peak number of pools that the domain needed
+   during a major cycle, averaged over the last BOXROOT_RETAIN_DECAY
+   cycles or so. The memory of the pools kept is returned to the OS
+   until they are reused. See also boxroot_configure. */
+#ifndef BOXROOT_RETAIN_MIN_POOLS
+#define BOXROOT_RETAIN_MIN_POOLS 0
+#endif
+#ifndef BOXROOT_RETAIN_MAX_POOLS
+#define BOXROOT_RETAIN_MAX_POOLS 1024
+#endif
+#ifndef BOXROOT_RETAIN_DECAY
+#define BOXROOT_RETAIN_DECAY 4
+#endif
+
+
 /* }}} */
 
 /* {{{ Data types */
@@ -38,9 +81,25 @@ static_assert(!BXR_FORCE_REMOTE || BXR_MULTITHREAD,
 enum {
   YOUNG = BXR_CLASS_YOUNG,
   OLD,
-  UNTRACKED
+  UNTRACKED,
+  PENDING,
+  WEAK,
+  PERMANENT,
+  /* Young pools hold a young class of their domain (see
+     bxr_young_class) instead of YOUNG. Stale young classes denote old
+     pools. */
+  FIRST_YOUNG_CLASS = 16
 };
 
+#define Is_young_class(cl) ((cl) >= FIRST_YOUNG_CLASS)
+
+/* The roots of pending pools have not been darkened yet during the
+   current major cycle. Their domain id is encoded so that no domain
+   recognises them as its own: every deletion takes the slow path,
+   where the deletion barrier lives. */
+#define Pending_domain_id(dom_id) (-2 - (dom_id))
+#define Is_pending_domain_id(id) ((id) < -1)
+
 struct bxr_private {
   /* _Atomic */ bxr_slot contents;
 };
@@ -84,6 +143,10 @@ typedef struct pool {
   /* Owned by the pool ring. */
   struct pool *prev;
   struct pool *next;
+  /* The group owning the pool, if any, and the next pool of the
+     group. Owned by the domain of the group. */
+  struct group *group;
+  struct pool *group_next;
   /* Note: `mutex` and `delayed_fl` are placed on their own cache
      line. Notably, together they exactly fit 8 words on Linux
      64-bit and this only wastes two padding words. */
@@ -95,17 +158,97 @@ typedef struct pool {
   alignas(Cache_line_size) atomic_free_list delayed_fl;
   /* The pool mutex */
   mutex_t mutex;
+  /* Index of the pool in bxr_pool_table, or 0 if no compact handle
+     has been made for the pool yet */
+  _Atomic uint32_t index;
+  /* Whether the pool uses all of its memory, or only the size of
+     small pools. Pools are small when taken for young roots, and grow
+     when reused from the old ring (see grow_pool). Only shrunk when
+     empty. */
+  bool large;
   /* Allocated slots hold OCaml values. Unallocated slots hold a
      pointer to the next slot in the free list, or to the pool itself,
      denoting the empty free list. */
   bxr_slot roots[];
 } pool;
 
-#define POOL_CAPACITY ((int)((BXR_POOL_SIZE - sizeof(pool)) / sizeof(bxr_slot)))
+/* A group owns pools dedicated to its roots. They live in the rings
+   of the domain of the group like other pools, but they are never
+   made current, demoted or reclaimed individually: they are all
+   handed back to the free ring when the group is released. */
+typedef struct group {
+  /* The free list of the pool being filled, or empty_fl */
+  struct bxr_group_private public;
+  /* The domain owning the pools of the group, or -1 while they are
+     orphaned. Updated under orphan_mutex. */
+  atomic_int domain_id;
+  /* The pools of the group, linked through group_next */
+  pool *pools;
+  /* Next group in released_groups */
+  struct group *next_released;
+} group;
+
+/* Arrays are allocated with malloc, as a private header followed by
+   the public one and the elements. Like pools, they belong to a
+   domain, which scans them; the young ones during minor
+   collections. */
+typedef struct array {
+  /* Owned by the domain of the array */
+  struct array *next;
+  struct array **prevp;
+  /* The domain owning the array, or -1 while it is orphaned. Updated
+     under orphan_mutex. */
+  atomic_int domain_id;
+  /* Deleted by someone else than its domain, to be freed by the
+     domain at the next scanning of the array. */
+  atomic_bool deleted;
+  /* Must come last */
+  struct bxr_array_private public;
+} array;
+
+#define Array_val(a) ((array *)((char *)(a) - offsetof(array, public)))
+
+/* Intrusive cells are registered in per-domain registries, made of
+   aligned chunks of slots. A slot holds either a pointer to a
+   registered cell, a link in the free list of the registry (tagged
+   with 1), or a tombstone left by an unregistration from another
+   domain, reclaimed by the domain at its next scanning. Young cells
+   (those that may contain young values) and old cells have separate
+   registries. */
+#define CELL_CHUNK_SIZE ((size_t)4096)
+
+typedef struct cell_chunk {
+  struct cell_chunk *next;
+  /* -1 while orphaned. Changed during STW only. */
+  int domain_id;
+  uintptr_t slots[];
+} cell_chunk;
+
+#define CELL_CHUNK_CAPACITY \
+  ((int)((CELL_CHUNK_SIZE - sizeof(cell_chunk)) / sizeof(uintptr_t)))
+#define CELL_TOMBSTONE ((uintptr_t)2)
+#define Is_cell(x) ((x) != 0 && ((x) & 3) == 0)
+#define Cell_slot(c) ((uintptr_t *)((c)->bxr_slot & ~(uintptr_t)1))
+#define Cell_chunk(s) \
+  ((cell_chunk *)((uintptr_t)(s) & ~((uintptr_t)CELL_CHUNK_SIZE - 1)))
 
-static_assert(BXR_POOL_SIZE / sizeof(bxr_slot) <= INT_MAX, "pool size too large");
-static_assert(POOL_CAPACITY >= 1, "pool size too small");
+typedef struct {
+  cell_chunk *chunks;
+  /* Free slots, or NULL */
+  uintptr_t *free;
+  int class;
+} cell_registry;
+
+#define Pool_capacity(log_size) \
+  ((int)((((size_t)1 << (log_size)) - sizeof(pool)) / sizeof(bxr_slot)))
+
+static_assert(((size_t)1 << BXR_POOL_MAX_LOG_SIZE) / sizeof(bxr_slot) <= INT_MAX,
+              "pool size too large");
+static_assert(Pool_capacity(BXR_POOL_MIN_LOG_SIZE) >= 1, "pool size too small");
 static_assert(offsetof(pool, free_list) == 0, "incorrect free_list offset");
+static_assert(((size_t)1 << BXR_POOL_MAX_LOG_SIZE) / sizeof(bxr_slot)
+              == (size_t)1 << BXR_COMPACT_SLOT_BITS,
+              "incorrect BXR_COMPACT_SLOT_BITS");
 
 /* }}} */
 
@@ -116,6 +259,10 @@ typedef struct {
   /* Pool of old values: contains only roots pointing to the major
      heap. Scanned at the start of major collection. */
   pool *old;
+  /* Old pools whose roots remain to be darkened in the current major
+     cycle (CONCURRENT_MARKING only). Darkened at the first major
+     slice or root scanning of the domain, or at its termination. */
+  pool *pending;
   /* Pool of young values: contains roots pointing to the major or to
      the minor heap. Scanned at the start of minor and major
      collection. */
@@ -125,41 +272,167 @@ typedef struct {
      exists has an incorrect allocation count. See
      {set,take}_current_pool. */
   pool *current;
+  /* Pools of weak roots: not marked, but their young values are
+     promoted during minor collections, and they are cleared of dead
+     values at the end of marking (OCaml 4) or at the start of the
+     next major cycle (OCaml 5). */
+  pool *weak;
+  /* Pools of permanent roots: never deallocated, scanned at the start
+     of major collection only, unless they received young values since
+     the last minor collection (then [permanent_young] is set). */
+  pool *permanent;
+  bool permanent_young;
+  /* Number of pools of the free ring kept at major collection, see
+     boxroot_reserve. */
+  int reserved_pools;
+  /* Pools taken minus pools emptied since the last major collection,
+     its peak, and the decaying average of the peaks (scaled by
+     config.retain_decay). See release_free_pools. */
+  int pool_demand;
+  int peak_demand;
+  long average_peak_demand;
   /* Pools containing no root: not scanned.
      We could free these pools immediately, but this could lead to
      stuttering behavior for workloads that regularly come back to
      0 boxroots alive. Instead we wait for the next major root
      scanning to free empty pools. */
   pool *free;
+  /* Arrays, scanned at the start of minor and major collection for
+     young arrays, and of major collection only for old arrays. */
+  array *young_arrays;
+  array *old_arrays;
+  /* Intrusive cells, scanned like arrays. */
+  cell_registry young_cells;
+  cell_registry old_cells;
+  /* Whether the domain is registered in adopting_domain. False for
+     the rings left behind by a terminated domain, which are reset
+     but kept, since other threads may still reach them. */
+  bool adopting;
 } pool_rings;
 
+/* The per-domain tables below are allocated at setup, with one entry
+   for each domain that the runtime can have (see
+   alloc_domain_tables). */
+
 /* Only accessed from one's own domain. Ownership requires the domain
    lock. */
 // TODO: Avoid false sharing?
-static pool_rings *pools[Num_domains] = { NULL };
+static pool_rings **pools = NULL;
 
 /* Holds the live pools of terminated domains until the next GC.
-   Owned by orphan_mutex. */
-static pool_rings orphan = { NULL, NULL, NULL, NULL };
+   orphan[i] is adopted by domain i at its next root scanning. The
+   last one, orphan[Num_domains], holds the pools orphaned while no
+   other domain had pools; it is adopted by the first domain arriving
+   at root scanning. Owned by orphan_mutex. */
+static pool_rings *orphan = NULL;
+/* Domains with initialised pool rings. They take part in every root
+   scanning until they terminate, and can therefore adopt orphaned
+   pools. Owned by orphan_mutex. */
+static bool *adopting_domain = NULL;
+/* Where to resume the distribution of orphaned pools, so that the
+   remainders do not always land on the same domain. Owned by
+   orphan_mutex. */
+static int orphan_cursor = 0;
 static mutex_t orphan_mutex = BXR_MUTEX_INITIALIZER;
+/* Whether some orphan rings may hold weak pools, which must be
+   updated even before they are adopted. */
+static atomic_bool weak_orphans = false;
+
+/* Groups released without holding the lock of their domain. Their
+   pools are released by their domain at its next root scanning.
+   Owned by orphan_mutex. */
+static group *released_groups = NULL;
 
 static bxr_free_list empty_fl = { (bxr_slot_ref)&empty_fl, NULL, -1, -1, UNTRACKED };
 
+/* The table of pools, indexed by the pool part of compact handles.
+   Allocated when the first compact handle is made, and only holds the
+   pools that compact handles point into. Free indices are linked
+   through their entries (cast from integers), starting at
+   pool_table_free. Index 0 is never used, so that the compact handle
+   0 is invalid. Owned by pool_table_mutex, except for reading the
+   entries of live pools. */
+bxr_slot **bxr_pool_table = NULL;
+static uint32_t pool_table_free = 0;
+static uint32_t pool_table_fresh = 1;
+static mutex_t pool_table_mutex = BXR_MUTEX_INITIALIZER;
+
+struct bxr_params bxr_params =
+  { ~((uintptr_t)BXR_POOL_SIZE - 1), (int)BXR_POOL_SIZE / 2 };
+
+/* Parameters fixed at initialisation, see read_config. */
+static struct {
+  /* Size of the large pools. Every pool is allocated and aligned with
+     this size. */
+  int pool_log_size;
+  size_t pool_size;
+  /* Capacity of small and large pools */
+  int capacity[2];
+  /* See is_not_too_full */
+  int low_water_count[2];
+  int retain_min_pools;
+  int retain_max_pools;
+  int retain_decay;
+} config;
+
+/* Limits on the memory of allocated pools in bytes (0 for none), see
+   boxroot_set_memory_limits. */
+static _Atomic(size_t) soft_limit = 0;
+static _Atomic(size_t) hard_limit = 0;
+static _Atomic(boxroot_memory_callback) soft_limit_callback = NULL;
+
+/* Number of pools allocated minus pools freed, sharded according to
+   the domain of the thread doing it (the first shard is for threads
+   outside of any domain), to avoid contention. Only the sum is
+   meaningful. */
+typedef struct {
+  alignas(Cache_line_size) atomic_llong count;
+} pool_counter;
+
+static pool_counter *allocated_pools = NULL;
+
+/* Boxroots of finalised custom blocks, deleted in bulk at the next
+   major slice of the domain that finalised them (see
+   boxroot_custom_ops). Only accessed from one's own domain. */
+typedef struct {
+  boxroot *roots;
+  size_t count;
+  size_t capacity;
+} finalised_queue;
+
+static finalised_queue *finalised = NULL;
+
 /* We cache the domain id for:
   - Fast detection of initialization (-1 if not initialized on this domain)
   - Lookup of current domain id fast and in parallel with other tests
 */
-_Thread_local ptrdiff_t bxr_cached_dom_id = -1;
+_Thread_local ptrdiff_t bxr_cached_dom_id BXR_TLS_MODEL = -1;
 
 /* Only accessed from one's own domain. Ownership requires the domain
-   lock. */
+   lock. Read by the fast path, hence sized statically so that it is
+   reached with a single load. */
 // TODO: Avoid false sharing?
-bxr_free_list *bxr_current_free_list[Num_domains + 1] =
+bxr_free_list *bxr_current_free_list[Max_num_domains + 1] =
   { &empty_fl, /* domain -1, always empty (trap for initialization) */
     &empty_fl, /* domain 0, accessed without initialization when
                   BXR_MULTITHREAD == 0 */
     /* NULL...*/ };
 
+/* Owned by the domain; written during STW sections only. 0 (never a
+   young class) for threads outside any domain. */
+int bxr_young_class[Max_num_domains + 1] = { 0 };
+/* Source of fresh young classes, shared by the domains so that
+   classes are not reused before a major collection (see
+   settle_old_pools). */
+static atomic_uint young_classes = 0;
+
+/* ownership required: none */
+static int new_young_class()
+{
+  unsigned n = incr(&young_classes);
+  return FIRST_YOUNG_CLASS + (int)(n % (unsigned)(INT_MAX - FIRST_YOUNG_CLASS));
+}
+
 /* ownership required: domain */
 static void set_current_fl(int dom_id, bxr_free_list *fl)
 {
@@ -168,17 +441,47 @@ static void set_current_fl(int dom_id, bxr_free_list *fl)
 }
 
 /* ownership required: domain */
-static void init_pool_rings(int dom_id)
+static void reset_pool_rings(pool_rings *local, int dom_id)
 {
-  pool_rings *local = pools[dom_id];
-  if (local == NULL) local = malloc(sizeof(pool_rings));
-  if (local == NULL) return;
   local->old = NULL;
+  local->pending = NULL;
+  local->weak = NULL;
+  local->permanent = NULL;
+  local->permanent_young = false;
+  local->reserved_pools = 0;
+  local->pool_demand = 0;
+  local->peak_demand = 0;
+  local->average_peak_demand = 0;
   local->young = NULL;
   local->current = NULL;
   local->free = NULL;
+  local->young_arrays = NULL;
+  local->old_arrays = NULL;
+  local->young_cells = (cell_registry){ NULL, NULL, YOUNG };
+  bxr_young_class[dom_id + 1] = new_young_class();
+  local->old_cells = (cell_registry){ NULL, NULL, OLD };
+  local->adopting = false;
   set_current_fl(dom_id, &empty_fl);
+}
+
+/* ownership required: domain */
+static bool has_pool_rings(int dom_id)
+{
+  return pools[dom_id] != NULL && pools[dom_id]->adopting;
+}
+
+/* ownership required: domain */
+static void init_pool_rings(int dom_id)
+{
+  pool_rings *local = pools[dom_id];
+  if (local == NULL) local = malloc(sizeof(pool_rings));
+  if (local == NULL) return;
+  reset_pool_rings(local, dom_id);
+  local->adopting = true;
   pools[dom_id] = local;
+  bxr_mutex_lock(&orphan_mutex);
+  adopting_domain[dom_id] = true;
+  bxr_mutex_unlock(&orphan_mutex);
 }
 
 static struct {
@@ -192,9 +495,14 @@ static struct {
   atomic_llong total_delete_slow;
   atomic_llong total_modify;
   atomic_llong total_modify_slow;
+  atomic_llong total_migrate;
+  atomic_llong total_finalised; // boxroots of finalised custom blocks
   atomic_llong total_gc_pool_rings;
   atomic_llong total_scanning_work_minor;
   atomic_llong total_scanning_work_major;
+  atomic_llong total_scanning_work_shared; // minor work done by helpers
+  atomic_llong total_deferred_scans; // major scans deferring old pools
+  atomic_llong total_scanning_work_pending; // darkening of pending pools
   atomic_llong total_minor_time;
   atomic_llong total_major_time;
   atomic_llong peak_minor_time;
@@ -203,6 +511,8 @@ static struct {
   atomic_llong total_emptied_pools;
   atomic_llong total_freed_pools;
   atomic_llong live_pools; // number of tracked pools
+  atomic_llong soft_limit_events; // times the soft limit was reached
+  atomic_llong hard_limit_failures; // allocations denied by the hard limit
   atomic_llong peak_pools; // max live pools at any time
   atomic_llong ring_operations; // Number of times p->next is mutated
   atomic_llong young_hit_gen; /* number of times a young value was encountered
@@ -214,7 +524,8 @@ static struct {
 } stats;
 
 // Can be left on, should have no impact on performance unless DEBUG == 1
-#define STATS 1
+// Off in the single-threaded build, which aims at the leanest fast paths
+#define STATS (!BOXROOT_SINGLE_THREADED)
 #if STATS
 #define STATS_INCR(x) (incr(&stats.x))
 #define STATS_DECR(x) (decr(&stats.x))
@@ -235,6 +546,22 @@ static inline pool * get_pool_header(bxr_slot_ref s)
   return (pool *)Bxr_get_pool_header(s);
 }
 
+/* The class of a pool, YOUNG for young pools */
+/* ownership required: pool */
+static inline int pool_class(pool *p)
+{
+  int cl = p->free_list.class;
+  if (!Is_young_class(cl)) return cl;
+  int dom_id = p->free_list.domain_id;
+  return (dom_id >= 0 && cl == bxr_young_class[dom_id + 1]) ? YOUNG : OLD;
+}
+
+/* ownership required: none */
+static inline int pool_capacity(pool *p)
+{
+  return config.capacity[p->large];
+}
+
 // Return true iff v shares the same msbs as p and is not an
 // immediate.
 // hot path
@@ -242,7 +569,7 @@ static inline pool * get_pool_header(bxr_slot_ref s)
 static inline bool is_pool_member(bxr_slot v, pool *p)
 {
   if (BOXROOT_DEBUG) STATS_INCR(is_pool_member);
-  return (uintptr_t)p == ((uintptr_t)v.as_slot_ref & ~((uintptr_t)BXR_POOL_SIZE - 2));
+  return (uintptr_t)p == ((uintptr_t)v.as_slot_ref & (bxr_params.pool_mask | 1));
 }
 
 // hot path
@@ -273,7 +600,9 @@ static inline void ring_push_back(pool *source, pool **target)
   if (*target == NULL) {
     *target = source;
   } else {
-    DEBUGassert((*target)->free_list.class == source->free_list.class);
+    DEBUGassert(pool_class(*target) == pool_class(source)
+                || Is_young_class((*target)->free_list.class)
+                || Is_young_class(source->free_list.class));
     pool *target_last = (*target)->prev;
     pool *source_last = source->prev;
     ring_link(target_last, source);
@@ -312,11 +641,128 @@ static inline bool is_full_pool(pool *p)
   return is_empty_free_list(p->free_list.next, p);
 }
 
+/* Make every slot of the pool free. Pools released by their group
+   are left uninitialised in the free ring, so that the release does
+   not visit their slots; they are initialised when reused. */
+/* ownership required: pool */
+static void init_free_list(pool *p)
+{
+  p->free_list.next = p->roots;
+  p->free_list.alloc_count = 0;
+  int capacity = pool_capacity(p);
+  p->free_list.end = &p->roots[capacity - 1];
+  store_relaxed(&p->delayed_fl.a_next, empty_free_list(p));
+  store_relaxed(&p->delayed_fl.a_alloc_count, 0);
+  p->delayed_fl.end = NULL;
+  /* We end the free_list with a dummy value which satisfies is_pool_member */
+  p->roots[capacity - 1].as_slot_ref = empty_free_list(p);
+  for (bxr_slot_ref s = p->roots + capacity - 2; s >= p->roots; --s) {
+    s->as_slot_ref = s + 1;
+  }
+}
+
+/* Make the empty pool [p] small or large, and initialise it. When
+   shrinking, the memory beyond the small size is returned to the
+   OS. */
+/* ownership required: pool */
+static void init_empty_pool(pool *p, bool large)
+{
+  if (p->large && !large) {
+    int small = config.capacity[0];
+    bxr_decommit(&p->roots[small],
+                 (config.capacity[1] - small) * sizeof(bxr_slot));
+  }
+  p->large = large;
+  init_free_list(p);
+}
+
+/* Give the pool an index in the pool table, if it does not have one
+   yet. Return 0 if the table could not be allocated or is full. */
+/* ownership required: root in pool */
+static uint32_t register_pool(pool *p)
+{
+  uint32_t i = load_acquire(&p->index);
+  if (BXR_LIKELY(i != 0)) return i;
+  bxr_mutex_lock(&pool_table_mutex);
+  i = load_relaxed(&p->index);
+  if (i != 0) goto out;
+  if (bxr_pool_table == NULL) {
+    bxr_pool_table = calloc((size_t)1 << BXR_COMPACT_POOL_BITS,
+                            sizeof(bxr_slot *));
+    if (bxr_pool_table == NULL) goto out;
+  }
+  i = pool_table_free;
+  if (i != 0) {
+    pool_table_free = (uint32_t)(uintptr_t)bxr_pool_table[i];
+  } else if (pool_table_fresh < ((uint32_t)1 << BXR_COMPACT_POOL_BITS)) {
+    i = pool_table_fresh++;
+  }
+  if (i != 0) {
+    bxr_pool_table[i] = (bxr_slot *)p;
+    atomic_store_explicit(&p->index, i, memory_order_release);
+  }
+ out:
+  bxr_mutex_unlock(&pool_table_mutex);
+  if (i == 0) errno = ENOMEM;
+  return i;
+}
+
+/* ownership required: pool */
+static void unregister_pool(pool *p)
+{
+  uint32_t i = load_relaxed(&p->index);
+  if (i == 0) return;
+  bxr_mutex_lock(&pool_table_mutex);
+  bxr_pool_table[i] = (bxr_slot *)(uintptr_t)pool_table_free;
+  pool_table_free = i;
+  bxr_mutex_unlock(&pool_table_mutex);
+}
+
+/* ownership required: none */
+static long long allocated_pool_count()
+{
+  long long count = 0;
+  if (allocated_pools == NULL) return 0; /* not set up */
+  for (int i = 0; i <= Num_domains; i++)
+    count += load_relaxed(&allocated_pools[i].count);
+  return count;
+}
+
+/* ownership required: pool */
+static void free_pool(pool *p)
+{
+  unregister_pool(p);
+  bxr_free_pool(p);
+  decr(&allocated_pools[bxr_cached_dom_id + 1].count);
+}
+
 /* ownership required: none */
-static pool * get_empty_pool()
+static pool * get_empty_pool(bool large)
 {
-  pool *p = bxr_alloc_uninitialised_pool(BXR_POOL_SIZE);
+  long long count = allocated_pool_count();
+  /* Reaching the soft limit means having at least [soft_limit] bytes
+     of pools; respecting the hard limit means having at most
+     [hard_limit] bytes of pools. */
+  size_t hard = load_relaxed(&hard_limit);
+  size_t before = (size_t)count * config.pool_size;
+  size_t after = before + config.pool_size;
+  if (hard != 0 && after > hard) {
+    STATS_INCR(hard_limit_failures);
+    errno = ENOMEM;
+    return NULL;
+  }
+  pool *p = bxr_alloc_uninitialised_pool(config.pool_size);
   if (p == NULL) return NULL;
+  store_relaxed(&p->index, 0);
+  incr(&allocated_pools[bxr_cached_dom_id + 1].count);
+  /* Racy: the callback can be missed or called twice when several
+     domains reach the limit at the same time. */
+  size_t soft = load_relaxed(&soft_limit);
+  if (soft != 0 && before < soft && after >= soft) {
+    STATS_INCR(soft_limit_events);
+    boxroot_memory_callback callback = load_relaxed(&soft_limit_callback);
+    if (callback != NULL) callback(after);
+  }
   if (STATS) {
     long long live_pools = 1 + incr(&stats.live_pools);
     /* racy, but whatever */
@@ -324,20 +770,13 @@ static pool * get_empty_pool()
   }
   STATS_INCR(total_alloced_pools);
   ring_link(p, p);
-  p->free_list.next = p->roots;
-  p->free_list.alloc_count = 0;
-  p->free_list.end = &p->roots[POOL_CAPACITY - 1];
+  p->group = NULL;
+  p->group_next = NULL;
   p->free_list.domain_id = -1;
   p->free_list.class = UNTRACKED;
-  store_relaxed(&p->delayed_fl.a_next, empty_free_list(p));
-  store_relaxed(&p->delayed_fl.a_alloc_count, 0);
-  p->delayed_fl.end = NULL;
   bxr_initialize_mutex(&p->mutex);
-  /* We end the free_list with a dummy value which satisfies is_pool_member */
-  p->roots[POOL_CAPACITY - 1].as_slot_ref = empty_free_list(p);
-  for (bxr_slot_ref s = p->roots + POOL_CAPACITY - 2; s >= p->roots; --s) {
-    s->as_slot_ref = s + 1;
-  }
+  p->large = large;
+  init_free_list(p);
   return p;
 }
 
@@ -374,7 +813,7 @@ static void free_pool_ring(pool **ring)
 {
   while (*ring != NULL) {
     pool *p = ring_pop(ring);
-    bxr_free_pool(p);
+    free_pool(p);
     STATS_INCR(total_freed_pools);
   }
 }
@@ -383,11 +822,88 @@ static void free_pool_ring(pool **ring)
 static void free_pool_rings(pool_rings *ps)
 {
   free_pool_ring(&ps->old);
+  free_pool_ring(&ps->pending);
+  free_pool_ring(&ps->weak);
+  free_pool_ring(&ps->permanent);
   free_pool_ring(&ps->young);
   free_pool_ring(&ps->current);
   free_pool_ring(&ps->free);
 }
 
+/* Return the memory of the slots of an empty pool to the OS. The
+   pool is left uninitialised. */
+/* ownership required: pool */
+static void decommit_pool(pool *p)
+{
+  if (p->free_list.next == NULL) return;
+  p->free_list.next = NULL;
+  bxr_decommit(p->roots, config.capacity[1] * sizeof(bxr_slot));
+}
+
+/* Free the pools of the free ring, except for the reserved ones and
+   for the number of pools that the domain is expected to need again
+   during the next cycle. Workloads that regularly come back to 0
+   boxroots alive then do not reallocate their pools at every cycle.
+   The reserved pools are initialised, so that reusing them touches
+   no fresh memory; the memory of the other pools kept is returned to
+   the OS. */
+/* ownership required: domain */
+static void release_free_pools(int dom_id)
+{
+  pool_rings *local = pools[dom_id];
+  local->average_peak_demand +=
+    local->peak_demand - local->average_peak_demand / config.retain_decay;
+  long target = local->average_peak_demand / config.retain_decay;
+  if (target < config.retain_min_pools) target = config.retain_min_pools;
+  if (target > config.retain_max_pools) target = config.retain_max_pools;
+  local->pool_demand = 0;
+  local->peak_demand = 0;
+  pool *kept = NULL;
+  for (long i = 0; i < local->reserved_pools + target && local->free != NULL;
+       i++) {
+    pool *p = ring_pop(&local->free);
+    if (i >= local->reserved_pools) decommit_pool(p);
+    else if (p->free_list.next == NULL) init_free_list(p);
+    ring_push_back(p, &kept);
+  }
+  free_pool_ring(&local->free);
+  local->free = kept;
+}
+
+/* ownership required: none */
+void boxroot_set_memory_limits(size_t soft, size_t hard,
+                               boxroot_memory_callback callback)
+{
+  store_relaxed(&soft_limit_callback, callback);
+  store_relaxed(&soft_limit, soft);
+  store_relaxed(&hard_limit, hard);
+}
+
+/* Make the pool [p] large, by adding the slots beyond the small size
+   at the front of its free list. Unlike shrinking, this does not
+   require the pool to be empty, since no root moves.
+
+   Pools are taken small for young roots, with less free space to
+   walk through at minor collection. A pool that survived promotion
+   and is reused for allocation from the old ring is made large, so
+   that the roots that end up old live in fewer, denser pools, with
+   fewer pools to visit at major collection. */
+/* ownership required: domain, pool */
+static void grow_pool(pool *p)
+{
+  int small = config.capacity[0];
+  int large = config.capacity[1];
+  if (p->large || small == large) return;
+  bxr_slot_ref next = p->free_list.next;
+  if (is_empty_free_list(next, p)) p->free_list.end = &p->roots[large - 1];
+  p->roots[large - 1].as_slot_ref = next;
+  for (bxr_slot_ref s = p->roots + large - 2; s >= p->roots + small; --s) {
+    s->as_slot_ref = s + 1;
+  }
+  p->free_list.next = &p->roots[small];
+  p->large = true;
+}
+
 /* }}} */
 
 /* {{{ Pool class management */
@@ -395,7 +911,7 @@ static void free_pool_rings(pool_rings *ps)
 /* ownership required: pool */
 static inline bool is_not_too_full(pool *p)
 {
-  return p->free_list.alloc_count <= (int)(BXR_DEALLOC_THRESHOLD / sizeof(bxr_slot));
+  return p->free_list.alloc_count <= config.low_water_count[p->large];
 }
 
 /* Change the current pool from NULL to p */
@@ -408,7 +924,7 @@ static void set_current_pool(int dom_id, pool *p)
   DEBUGassert(p->next == p);
   p->free_list.domain_id = dom_id;
   local->current = p;
-  p->free_list.class = YOUNG;
+  p->free_list.class = bxr_young_class[dom_id + 1];
   // Prevent the current pool from triggering a slow deallocation
   // path when empty.
   p->free_list.alloc_count++;
@@ -434,6 +950,19 @@ static void move_current_to_young(int dom_id)
   }
 }
 
+/* Return the location of the pool [*p] suitable for reclassify_pool:
+   if the pool is at the head of its ring, the new head must be
+   recorded. */
+/* ownership required: domain */
+static pool ** ring_source(int dom_id, pool **p)
+{
+  pool_rings *local = pools[dom_id];
+  return (*p == local->old) ? &local->old :
+         (*p == local->young) ? &local->young :
+         (*p == local->pending) ? &local->pending :
+         (*p == local->weak) ? &local->weak : p;
+}
+
 /* Move not-too-full pools to the front; move empty pools to the free
    ring. */
 /* ownership required: domain, pool */
@@ -441,13 +970,10 @@ static void try_demote_pool(int dom_id, pool *p)
 {
   DEBUGassert(p->free_list.class != UNTRACKED);
   pool_rings *local = pools[dom_id];
-  if (p == local->current || !is_not_too_full(p)) return;
-  int cl = (p->free_list.alloc_count == 0) ? UNTRACKED : p->free_list.class;
-  /* If the pool is at the head of its ring, the new head must be
-     recorded. */
-  pool **source = (p == local->old) ? &local->old :
-                  (p == local->young) ? &local->young : &p;
-  reclassify_pool(source, dom_id, cl);
+  if (p == local->current || p->group != NULL || !is_not_too_full(p))
+    return;
+  int cl = (p->free_list.alloc_count == 0) ? UNTRACKED : pool_class(p);
+  reclassify_pool(ring_source(dom_id, &p), dom_id, cl);
 }
 
 /* ownership required: ring */
@@ -456,11 +982,32 @@ static inline pool * pop_available(pool **target)
   /* When pools empty themselves enough, they are pushed to the front.
      When they fill up, they are pushed to the back. Thus, if the
      first one is full, then none of the next ones are empty
-     enough. */
-  if (*target == NULL || is_full_pool(*target)) return NULL;
+     enough. Pools of groups are always at the back. */
+  if (*target == NULL || is_full_pool(*target) || (*target)->group != NULL)
+    return NULL;
   return ring_pop(target);
 }
 
+/* Take an empty pool from the free ring, or allocate a new one, of
+   the requested size. Return NULL if the allocation failed. */
+/* ownership required: domain */
+static pool * take_empty_pool(int dom_id, bool large)
+{
+  pool_rings *local = pools[dom_id];
+  pool *p = pop_available(&local->free);
+  if (p == NULL) {
+    p = get_empty_pool(large);
+    if (p == NULL) return NULL;
+  } else {
+    if (p->free_list.next == NULL || p->large != large)
+      init_empty_pool(p, large);
+    if (local->reserved_pools > 0) local->reserved_pools--;
+  }
+  if (++local->pool_demand > local->peak_demand)
+    local->peak_demand = local->pool_demand;
+  return p;
+}
+
 /* Find an available pool and set it as current. Return NULL if none
    was found and the allocation of a new one failed. */
 /* ownership required: domain */
@@ -468,10 +1015,11 @@ static void find_and_set_available_pool(int dom_id)
 {
   pool_rings *local = pools[dom_id];
   pool *p = pop_available(&local->young);
-  if (p == NULL && local->old != NULL && is_not_too_full(local->old))
+  if (p == NULL && local->old != NULL && is_not_too_full(local->old)) {
     p = pop_available(&local->old);
-  if (p == NULL) p = pop_available(&local->free);
-  if (p == NULL) p = get_empty_pool();
+    if (p != NULL) grow_pool(p);
+  }
+  if (p == NULL) p = take_empty_pool(dom_id, false);
   DEBUGassert(local->current == NULL);
   DEBUGassert(!is_full_pool(p));
   set_current_pool(dom_id, p);
@@ -488,23 +1036,28 @@ static void reclassify_pool(pool **source, int dom_id, int cl)
   DEBUGassert(*source != NULL);
   pool_rings *local = pools[dom_id];
   pool *p = ring_pop(source);
-  p->free_list.domain_id = dom_id;
+  p->free_list.domain_id = (cl == PENDING) ? Pending_domain_id(dom_id) : dom_id;
+  if (p->group != NULL) store_relaxed(&p->group->domain_id, dom_id);
   pool **target = NULL;
   switch (cl) {
   case OLD: target = &local->old; break;
+  case PENDING: target = &local->pending; break;
+  case WEAK: target = &local->weak; break;
+  case PERMANENT: target = &local->permanent; break;
   case YOUNG: target = &local->young; break;
   case UNTRACKED:
     target = &local->free;
+    local->pool_demand--;
     STATS_INCR(total_emptied_pools);
     STATS_DECR(live_pools);
     break;
   }
   /* protected by domain lock */
-  p->free_list.class = cl;
+  p->free_list.class = (cl == YOUNG) ? bxr_young_class[dom_id + 1] : cl;
   ring_push_back(p, target);
   /* make p the new head of [*target] (rotate one step backwards) if
-     it is not too full. */
-  if (is_not_too_full(p)) *target = p;
+     it is not too full and available for allocation. */
+  if (is_not_too_full(p) && p->group == NULL) *target = p;
 }
 
 /* Reclassify a full ring while maintaining ordering */
@@ -517,12 +1070,74 @@ static void reclassify_ring(pool **ring, int dom_id, int cl)
   }
 }
 
+/* Append the ring [source] at the back of [*target] in O(1). */
+/* ownership required: rings */
+static void ring_append(pool *source, pool **target)
+{
+  if (source == NULL) return;
+  if (*target == NULL) {
+    *target = source;
+    return;
+  }
+  pool *target_last = (*target)->prev;
+  pool *source_last = source->prev;
+  ring_link(target_last, source);
+  ring_link(source_last, *target);
+}
+
+/* Remove the pools of groups from the back of [*ring] and return them
+   as a ring, in time proportional to their number. */
+/* ownership required: ring */
+static pool * ring_detach_groups(pool **ring)
+{
+  pool *groups = NULL;
+  while (*ring != NULL && (*ring)->prev->group != NULL) {
+    pool *last = (*ring)->prev;
+    if (last == *ring) *ring = NULL;
+    else ring_link(last->prev, last->next);
+    ring_link(last, last);
+    ring_append(groups, &last);
+    groups = last;
+  }
+  return groups;
+}
+
+/* Splice the ring [*source] onto [*target], keeping the pools of
+   groups at the back (see pop_available). The other pools of
+   [*source] go at the front if its head is available for allocation,
+   and before the pools of groups of [*target] otherwise. This takes
+   time proportional to the number of pools of groups involved. */
+/* ownership required: rings */
+static void ring_splice(pool **source, pool **target)
+{
+  pool *groups = ring_detach_groups(source);
+  pool *p = *source;
+  *source = NULL;
+  if (p != NULL && is_not_too_full(p)) {
+    ring_append(*target, &p);
+    *target = p;
+  } else if (p != NULL) {
+    pool *target_groups = ring_detach_groups(target);
+    ring_append(p, target);
+    ring_append(target_groups, target);
+  }
+  ring_append(groups, target);
+}
+
 /* ownership required: domain */
 static void promote_young_pools(int dom_id)
 {
   pool_rings *local = pools[dom_id];
-  // Promote non-empty pools
-  reclassify_ring(&local->young, dom_id, OLD);
+  /* Promote non-empty pools without visiting them: the young pools
+     become old by giving a new young class to the domain, and only
+     the pools of groups are moved separately to stay at the back of
+     the old ring. The young ring keeps its not-too-full pools first,
+     but once spliced, not-too-full old pools can end up behind full
+     young ones. They are found again when they are demoted, or when
+     the ring is reordered at the next major collection (see
+     settle_old_pools). */
+  bxr_young_class[dom_id + 1] = new_young_class();
+  ring_splice(&local->young, &local->old);
   // There is no current pool to promote. Ensure that a domain that
   // does not use any boxroot between two minor collections does not
   // pay the cost of scanning any pool.
@@ -533,6 +1148,35 @@ static void promote_young_pools(int dom_id)
 
 /* {{{ Allocation, deallocation */
 
+/* Snapshot-at-the-beginning barrier for pending pools: the value
+   about to be overwritten or deleted must be darkened, since it was
+   reachable at the start of the cycle and the mutator may have
+   copied it elsewhere. */
+/* ownership required: root, a domain lock */
+static void darken_pending_value(boxroot root)
+{
+#if CONCURRENT_MARKING
+  value v = root->contents.as_value;
+  /* Pending pools are old: they do not contain young values. */
+  if (Is_block(v)) caml_darken(Caml_state, v, NULL);
+#else
+  (void)root;
+#endif
+}
+
+/* Deletion barrier. Return whether the deletion is remote. */
+/* ownership required: root */
+static bool pending_delete_barrier(pool *p, boxroot root)
+{
+  /* A thread that does not hold a domain lock cannot have stored the
+     value elsewhere, so there is nothing to do. Otherwise the pool
+     might be darkened by its owner concurrently, in which case the
+     value is darkened twice. */
+  if (!bxr_domain_lock_held()) return true;
+  darken_pending_value(root);
+  return Pending_domain_id(bxr_cached_dom_id) != p->free_list.domain_id;
+}
+
 /* Thread-safety: see documented constraints on the use of
    boxroot_setup and boxroot_teardown. */
 static atomic_int status = BOXROOT_NOT_SETUP;
@@ -552,6 +1196,8 @@ boxroot bxr_create_slow(value init)
 {
   STATS_INCR(total_create_slow);
   if (Caml_state_opt == NULL) { errno = EPERM; return NULL; }
+  /* The single-threaded build only serves the first domain. */
+  if (!BXR_MULTITHREAD && Domain_id != 0) { errno = EPERM; return NULL; }
   // We might be here because boxroot is not setup.
   if (0 == setup()) return NULL;
 #if !OCAML_MULTICORE
@@ -563,9 +1209,9 @@ boxroot bxr_create_slow(value init)
 #endif
   int dom_id = Domain_id;
   /* Initialize pool rings on this domain */
-  if (pools[dom_id] == NULL) init_pool_rings(dom_id);
+  if (!has_pool_rings(dom_id)) init_pool_rings(dom_id);
+  if (!has_pool_rings(dom_id)) return NULL; /* ENOMEM */
   pool_rings *local = pools[dom_id];
-  if (local == NULL) return NULL; /* ENOMEM */
   /* Initialization successful, now cache domain_id on this thread if
      not done. */
   if (bxr_cached_dom_id == -1) {
@@ -657,10 +1303,20 @@ static void free_slot_atomic(pool *p, boxroot root)
 }
 
 /* ownership required: root, current domain */
+static bool pending_delete_barrier(pool *p, boxroot root);
+
 void bxr_delete_slow(bxr_free_list *fl, boxroot root, bool remote)
 {
   STATS_INCR(total_delete_slow);
   pool *p = (pool *)fl;
+  if (CONCURRENT_MARKING && BXR_UNLIKELY(Is_pending_domain_id(fl->domain_id))) {
+    remote = pending_delete_barrier(p, root);
+    if (!remote) {
+      if (!bxr_free_slot(fl, root)) return;
+      try_demote_pool(bxr_cached_dom_id, p);
+      return;
+    }
+  }
   if (!remote) {
     /* We own the domain lock. Deallocation already done, but we
        passed a deallocation threshold. */
@@ -678,25 +1334,55 @@ void bxr_delete_slow(bxr_free_list *fl, boxroot root, bool remote)
 
 extern inline void boxroot_delete(boxroot root);
 
+static bool group_pool_accept_young(pool *p, boxroot root, value v);
+static boxroot_compact compact_of_root(boxroot root);
+
+/* With [h], [*root_ref] is the root of the compact handle [*h], which
+   is updated if the root is reallocated. */
 /* ownership required: root, current domain */
-bool bxr_modify_slow(boxroot *root_ref, value new_value)
+static bool modify_slow(boxroot *root_ref, value new_value,
+                        boxroot_compact *h)
 {
   STATS_INCR(total_modify_slow);
   boxroot root = *root_ref;
-  /* If the new value is not a young block, we can substitute. */
-  if (!Is_block(new_value) || !Is_young(new_value)) {
+  if (CONCURRENT_MARKING) {
+    pool *p = get_pool_header(&root->contents);
+    if (p->free_list.class == PENDING) darken_pending_value(root);
+  }
+  /* If the new value is not a young block, or if the pool is young
+     for another domain, we can substitute. */
+  if (!Is_block(new_value) || !Is_young(new_value)
+      || pool_class(get_pool_header(&root->contents)) == YOUNG) {
     root->contents.as_value = new_value;
     return true;
   }
   /* Else, the pool is old and the value is young, so we need to
-     reallocate */
+     reallocate, unless the root belongs to a group. */
+  pool *p = get_pool_header(&root->contents);
+  if (p->group != NULL) return group_pool_accept_young(p, root, new_value);
   boxroot new = boxroot_create(new_value);
   if (BXR_UNLIKELY(new == NULL)) return false;
+  if (h != NULL) {
+    /* Encode the new root before deleting the old one, since this can
+       fail. */
+    boxroot_compact new_h = compact_of_root(new);
+    if (BXR_UNLIKELY(new_h == 0)) {
+      boxroot_delete(new);
+      return false;
+    }
+    *h = new_h;
+  }
   *root_ref = new;
   boxroot_delete(root);
   return true;
 }
 
+/* ownership required: root, current domain */
+bool bxr_modify_slow(boxroot *root_ref, value new_value)
+{
+  return modify_slow(root_ref, new_value, NULL);
+}
+
 void bxr_modify_debug(boxroot *rootp)
 {
   DEBUGassert(*rootp);
@@ -705,6 +1391,138 @@ void bxr_modify_debug(boxroot *rootp)
 
 extern inline bool boxroot_modify(boxroot *rootp, value new_value);
 
+/* Return 0 if the pool of the root could not be registered. */
+/* ownership required: root */
+static boxroot_compact compact_of_root(boxroot root)
+{
+  pool *p = get_pool_header(&root->contents);
+  uint32_t index = register_pool(p);
+  if (BXR_UNLIKELY(index == 0)) return 0;
+  ptrdiff_t offset = &root->contents - (bxr_slot_ref)p;
+  return (index << BXR_COMPACT_SLOT_BITS) | (boxroot_compact)offset;
+}
+
+/* ownership required: current domain */
+boxroot_compact boxroot_compact_create(value init)
+{
+  boxroot root = boxroot_create(init);
+  if (BXR_UNLIKELY(root == NULL)) return 0;
+  boxroot_compact h = compact_of_root(root);
+  if (BXR_UNLIKELY(h == 0)) boxroot_delete(root);
+  return h;
+}
+
+/* ownership required: root, current domain */
+bool bxr_compact_modify_slow(boxroot_compact *h, value new_value)
+{
+  boxroot root = Bxr_compact_root(*h);
+  return modify_slow(&root, new_value, h);
+}
+
+extern inline value boxroot_compact_get(boxroot_compact h);
+extern inline value const * boxroot_compact_get_ref(boxroot_compact h);
+extern inline void boxroot_compact_delete(boxroot_compact h);
+extern inline bool boxroot_compact_modify(boxroot_compact *h, value v);
+
+/* ownership required: root, current domain */
+bool boxroot_migrate(boxroot *root_ref)
+{
+  if (!bxr_domain_lock_held()) { errno = EPERM; return false; }
+  boxroot root = *root_ref;
+  pool *p = get_pool_header(&root->contents);
+  /* Only deallocations from a different domain are remote. (In OCaml
+     4 every pool belongs to the only domain.) */
+  if (!OCAML_MULTICORE || p->free_list.domain_id == bxr_cached_dom_id)
+    return true;
+  STATS_INCR(total_migrate);
+  boxroot new = boxroot_create(boxroot_get(root));
+  if (BXR_UNLIKELY(new == NULL)) return false;
+  *root_ref = new;
+  /* Remote deallocation, paid once. */
+  boxroot_delete(root);
+  return true;
+}
+
+static bool setup_current_domain();
+
+/* ownership required: current domain */
+bool boxroot_reserve(size_t n)
+{
+  if (!setup_current_domain()) return false;
+  int dom_id = Domain_id;
+  pool_rings *local = pools[dom_id];
+  /* Creations take small pools, see grow_pool */
+  bool large = false;
+  size_t capacity = config.capacity[large];
+  size_t needed = (n + capacity - 1) / capacity;
+  if (needed > INT_MAX) { errno = ENOMEM; return false; }
+  /* Initialise the first [needed] free pools, if they were left
+     uninitialised or have the wrong size. The others are left alone,
+     so as not to fault in the pools decommitted by
+     release_free_pools. */
+  size_t available = 0;
+  for (pool *p = local->free; p != NULL && available < needed;
+       p = (p->next == local->free) ? NULL : p->next) {
+    if (p->free_list.next == NULL || p->large != large)
+      init_empty_pool(p, large);
+    available++;
+  }
+  for (; available < needed; available++) {
+    /* Fresh pools are initialised, hence faulted in. They go straight
+       to the free ring: they were not taken, so they do not count in
+       the demand. */
+    pool *q = get_empty_pool(large);
+    if (q == NULL) return false; /* ENOMEM */
+    STATS_DECR(live_pools);
+    q->free_list.domain_id = dom_id;
+    ring_push_back(q, &local->free);
+  }
+  if ((int)needed > local->reserved_pools) local->reserved_pools = needed;
+  return true;
+}
+
+/* ownership required: roots */
+void boxroot_delete_many(boxroot const *roots, size_t n)
+{
+  if (!BXR_MULTITHREAD || BXR_FORCE_REMOTE || bxr_domain_lock_held()) {
+    for (size_t i = 0; i < n; i++) boxroot_delete(roots[i]);
+    return;
+  }
+  /* No domain lock held: every deallocation is remote. Release each
+     run of roots from the same pool under a single acquisition of the
+     pool mutex. */
+  size_t i = 0;
+  while (i < n) {
+    pool *p = get_pool_header(&roots[i]->contents);
+    if (CONCURRENT_MARKING
+        && BXR_UNLIKELY(Is_pending_domain_id(p->free_list.domain_id))) {
+      boxroot_delete(roots[i++]);
+      continue;
+    }
+    bxr_mutex_lock(&p->mutex);
+    do {
+      if (BOXROOT_DEBUG) bxr_delete_debug(roots[i]);
+      STATS_INCR(total_delete_slow);
+      free_slot_atomic(p, roots[i++]);
+    } while (i < n && get_pool_header(&roots[i]->contents) == p);
+    bxr_mutex_unlock(&p->mutex);
+  }
+}
+
+/* ownership required: current domain */
+bool boxroot_create_many(value const *values, boxroot *roots, size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    boxroot r = boxroot_create(values[i]);
+    if (BXR_UNLIKELY(r == NULL)) {
+      boxroot_delete_many(roots, i);
+      return false;
+    }
+    roots[i] = r;
+  }
+  return true;
+}
+
 /* }}} */
 
 /* {{{ Scanning */
@@ -722,18 +1540,19 @@ static void validate_pool(pool *pl)
   int pos = 0;
   for (; !is_empty_free_list(curr, pl); curr = curr->as_slot_ref, pos++)
   {
-    assert(pos < POOL_CAPACITY);
-    assert(curr >= pl->roots && curr < pl->roots + POOL_CAPACITY);
+    assert(pos < pool_capacity(pl));
+    assert(curr >= pl->roots && curr < pl->roots + pool_capacity(pl));
   }
-  assert(pos == POOL_CAPACITY - pl->free_list.alloc_count);
+  assert(pos == pool_capacity(pl) - pl->free_list.alloc_count);
   // check count of allocated elements
   int count = 0;
-  for(int i = 0; i < POOL_CAPACITY; i++) {
+  for(int i = 0; i < pool_capacity(pl); i++) {
     bxr_slot s = pl->roots[i];
     STATS_DECR(is_pool_member);
     if (!is_pool_member(s, pl)) {
       value v = s.as_value;
-      if (pl->free_list.class != YOUNG && Is_block(v)) assert(!Is_young(v));
+      int cl = pool_class(pl);
+      if ((cl == OLD || cl == PENDING) && Is_block(v)) assert(!Is_young(v));
       ++count;
     }
   }
@@ -748,7 +1567,7 @@ static void validate_ring(pool **ring, int dom_id, int cl)
   pool *p = start_pool;
   do {
     assert(p->free_list.domain_id == dom_id);
-    assert(p->free_list.class == cl);
+    assert(pool_class(p) == cl);
     validate_pool(p);
     assert(p->next != NULL);
     assert(p->next->prev == p);
@@ -770,37 +1589,142 @@ static void validate_all_pools(int dom_id)
 {
   pool_rings *local = pools[dom_id];
   validate_ring(&local->old, dom_id, OLD);
+  validate_ring(&local->pending, Pending_domain_id(dom_id), PENDING);
+  validate_ring(&local->weak, dom_id, WEAK);
+  validate_ring(&local->permanent, dom_id, PERMANENT);
   validate_ring(&local->young, dom_id, YOUNG);
   validate_current_pool(&local->current, dom_id);
   validate_ring(&local->free, dom_id, UNTRACKED);
 }
 
 static void gc_pool_rings(int dom_id);
+static int darken_pending_pools(int dom_id);
+static void release_group_pools(group *g, int dom_id);
+static void move_arrays(array **source, array **target, int dom_id);
+static void move_cell_chunks(cell_registry *source, cell_registry *target,
+                             int dom_id);
+
+/* Distribute the pools of [*source] one by one among the domains
+   [doms[0..n-1]], starting with [orphan_cursor]. The pools of groups
+   all go to [doms[group_target]], so that each group remains owned
+   by a single domain. */
+/* ownership required: ring, orphan_mutex */
+static void distribute_orphaned_ring(pool **source, int cl,
+                                     int *doms, int n, int group_target)
+{
+  while (*source != NULL) {
+    pool *p = ring_pop(source);
+    int i = orphan_cursor++ % n;
+    if (p->group != NULL) {
+      store_relaxed(&p->group->domain_id, -1);
+      i = group_target;
+    }
+    pool_rings *target = &orphan[doms[i]];
+    ring_push_back(p, (cl == OLD) ? &target->old : &target->young);
+  }
+}
 
+/* Give away the live pools of a terminating domain. Without balancing,
+   the first domain reaching root scanning would adopt all of them
+   and become the straggler of every subsequent parallel minor
+   collection after a burst of short-lived domains. Instead the pools
+   are dealt round-robin to the domains that will take part in the
+   next root scanning. */
 /* ownership required: STW */
 static void orphan_pools(int dom_id)
 {
   pool_rings *local = pools[dom_id];
   if (local == NULL) return;
+  if (CONCURRENT_MARKING) darken_pending_pools(dom_id);
   move_current_to_young(dom_id);
   gc_pool_rings(dom_id);
   bxr_mutex_lock(&orphan_mutex);
-  /* Move active pools to the orphaned pools. TODO: NUMA awareness? */
-  ring_push_back(local->old, &orphan.old);
-  ring_push_back(local->young, &orphan.young);
+  adopting_domain[dom_id] = false;
+  int doms[Num_domains];
+  int n = 0;
+  for (int i = 0; i < Num_domains; i++) {
+    if (adopting_domain[i]) doms[n++] = i;
+  }
+  /* Pools distributed to us but not yet adopted are given away as
+     well. */
+  ring_push_back(orphan[dom_id].old, &local->old);
+  ring_push_back(orphan[dom_id].young, &local->young);
+  orphan[dom_id].old = NULL;
+  orphan[dom_id].young = NULL;
+  if (n == 0) doms[n++] = Num_domains;
+  /* TODO: NUMA awareness? */
+  orphan_cursor %= n;
+  int group_target = orphan_cursor;
+  distribute_orphaned_ring(&local->old, OLD, doms, n, group_target);
+  distribute_orphaned_ring(&local->young, YOUNG, doms, n, group_target);
+  /* Arrays are given away with the groups */
+  pool_rings *heir = &orphan[doms[group_target]];
+  move_arrays(&local->young_arrays, &heir->young_arrays, -1);
+  move_arrays(&local->old_arrays, &heir->old_arrays, -1);
+  move_arrays(&orphan[dom_id].young_arrays, &heir->young_arrays, -1);
+  move_arrays(&orphan[dom_id].old_arrays, &heir->old_arrays, -1);
+  /* So are the weak pools */
+  if (local->weak != NULL) store_relaxed(&weak_orphans, true);
+  while (local->weak != NULL)
+    ring_push_back(ring_pop(&local->weak), &heir->weak);
+  while (orphan[dom_id].weak != NULL)
+    ring_push_back(ring_pop(&orphan[dom_id].weak), &heir->weak);
+  /* And the permanent pools */
+  while (local->permanent != NULL)
+    ring_push_back(ring_pop(&local->permanent), &heir->permanent);
+  while (orphan[dom_id].permanent != NULL)
+    ring_push_back(ring_pop(&orphan[dom_id].permanent), &heir->permanent);
+  move_cell_chunks(&local->young_cells, &heir->young_cells, -1);
+  move_cell_chunks(&local->old_cells, &heir->old_cells, -1);
+  move_cell_chunks(&orphan[dom_id].young_cells, &heir->young_cells, -1);
+  move_cell_chunks(&orphan[dom_id].old_cells, &heir->old_cells, -1);
   bxr_mutex_unlock(&orphan_mutex);
   /* Free the rest */
   free_pool_ring(&local->free);
-  /* Reset local pools for later domains spawning with the same id */
-  init_pool_rings(dom_id);
+  /* Keep the rings, which other threads of the domain may still
+     reach, but reset them. Later domains spawning with the same id
+     register again as adopting domains (see has_pool_rings). */
+  reset_pool_rings(local, dom_id);
 }
 
 /* ownership required: domain */
 static void adopt_orphaned_pools(int dom_id)
 {
   bxr_mutex_lock(&orphan_mutex);
-  reclassify_ring(&orphan.old, dom_id, OLD);
-  reclassify_ring(&orphan.young, dom_id, YOUNG);
+  reclassify_ring(&orphan[dom_id].old, dom_id, OLD);
+  reclassify_ring(&orphan[dom_id].young, dom_id, YOUNG);
+  reclassify_ring(&orphan[Num_domains].old, dom_id, OLD);
+  reclassify_ring(&orphan[Num_domains].young, dom_id, YOUNG);
+  reclassify_ring(&orphan[dom_id].weak, dom_id, WEAK);
+  reclassify_ring(&orphan[Num_domains].weak, dom_id, WEAK);
+  pool_rings *local = pools[dom_id];
+  if (orphan[dom_id].permanent != NULL
+      || orphan[Num_domains].permanent != NULL) {
+    /* They might contain young values */
+    local->permanent_young = true;
+    reclassify_ring(&orphan[dom_id].permanent, dom_id, PERMANENT);
+    reclassify_ring(&orphan[Num_domains].permanent, dom_id, PERMANENT);
+  }
+  move_arrays(&orphan[dom_id].young_arrays, &local->young_arrays, dom_id);
+  move_arrays(&orphan[dom_id].old_arrays, &local->old_arrays, dom_id);
+  move_arrays(&orphan[Num_domains].young_arrays, &local->young_arrays, dom_id);
+  move_arrays(&orphan[Num_domains].old_arrays, &local->old_arrays, dom_id);
+  move_cell_chunks(&orphan[dom_id].young_cells, &local->young_cells, dom_id);
+  move_cell_chunks(&orphan[dom_id].old_cells, &local->old_cells, dom_id);
+  move_cell_chunks(&orphan[Num_domains].young_cells, &local->young_cells, dom_id);
+  move_cell_chunks(&orphan[Num_domains].old_cells, &local->old_cells, dom_id);
+  /* Release the groups that were released remotely, now that the
+     groups we adopted have been assigned to us. */
+  group **r = &released_groups;
+  while (*r != NULL) {
+    group *g = *r;
+    if (load_relaxed(&g->domain_id) == dom_id) {
+      *r = g->next_released;
+      release_group_pools(g, dom_id);
+    } else {
+      r = &g->next_released;
+    }
+  }
   bxr_mutex_unlock(&orphan_mutex);
 }
 
@@ -808,11 +1732,11 @@ static void adopt_orphaned_pools(int dom_id)
 static void try_gc_and_reclassify_pool(pool **source, int dom_id)
 {
   pool *p = *source;
-  if (gc_pool(p) != 0) {
+  if (gc_pool(p) != 0 && p->group == NULL) {
     if (p->free_list.alloc_count == 0)
       reclassify_pool(source, dom_id, UNTRACKED);
     else if (is_not_too_full(p))
-      reclassify_pool(source, dom_id, p->free_list.class);
+      reclassify_pool(source, dom_id, pool_class(p));
   }
 }
 
@@ -880,6 +1804,24 @@ static void gc_pool_rings(int dom_id)
   DEBUGassert(local->current == NULL);
   gc_ring(&local->young, dom_id);
   gc_ring(&local->old, dom_id);
+  gc_ring(&local->weak, dom_id);
+}
+
+/* Distance in slots at which the headers of the values are
+   prefetched during generic scanning. */
+#define PREFETCH_DISTANCE 8
+
+/* The cost of darkening at the start of a major cycle is dominated by
+   cache misses on the headers of old values, which we cannot spread
+   over major slices (see the README). Prefetching the header of the
+   value a few slots ahead lets these misses overlap. */
+/* ownership required: STW, pool mutex */
+static inline void prefetch_header(pool *pl, ptrdiff_t i)
+{
+  if (i >= pool_capacity(pl)) return;
+  bxr_slot s = pl->roots[i];
+  if (!is_pool_member(s, pl) && Is_block(s.as_value))
+    BXR_PREFETCH_WRITE(Hp_val(s.as_value));
 }
 
 // returns the amount of work done
@@ -889,9 +1831,11 @@ static int scan_pool_gen(scanning_action action, void *data, pool *pl)
   int allocs_to_find = anticipated_alloc_count(pl);
   int young_hit = 0;
   bxr_slot_ref current = pl->roots;
+  for (int i = 0; i < PREFETCH_DISTANCE; i++) prefetch_header(pl, i);
   while (allocs_to_find) {
-    DEBUGassert(current < &pl->roots[POOL_CAPACITY]);
+    DEBUGassert(current < &pl->roots[pool_capacity(pl)]);
     // hot path
+    prefetch_header(pl, current - pl->roots + PREFETCH_DISTANCE);
     bxr_slot s = *current;
     if (!is_pool_member(s, pl)) {
       --allocs_to_find;
@@ -927,7 +1871,7 @@ static int scan_pool_young(scanning_action action, void *data, pool *pl)
   uintnat young_range = (uintnat)Caml_state->young_end - young_start;
 #endif
   bxr_slot_ref start = pl->roots;
-  bxr_slot_ref end = start + POOL_CAPACITY;
+  bxr_slot_ref end = start + pool_capacity(pl);
   int young_hit = 0;
   bxr_slot_ref current;
   for (current = start; current < end; current++) {
@@ -977,26 +1921,1027 @@ static int scan_pools(scanning_action action, int only_young,
 {
   pool_rings *local = pools[dom_id];
   int work = scan_ring(action, only_young, data, &local->young);
-  if (!only_young) work += scan_ring(action, 0, data, &local->old);
+  if (!only_young) {
+    work += scan_ring(action, 0, data, &local->old);
+    work += scan_ring(action, 0, data, &local->pending);
+  }
   return work;
 }
 
-/* ownership required: STW */
-static void scan_roots(scanning_action action, int only_young,
-                       void *data, int dom_id)
+/* }}} */
+
+/* {{{ Concurrent marking */
+
+/* With CONCURRENT_MARKING, the old pools are not darkened during the
+   stop-the-world root scanning at the start of the major cycle.
+   Instead they become pending, and each domain darkens its pending
+   pools at its next major slice (or root scanning, or termination),
+   outside of the stop-the-world section. The roots of pending pools
+   are protected by a snapshot-at-the-beginning barrier in
+   bxr_modify_slow and bxr_delete_slow (see darken_pending_value).
+   Young pools are still scanned during the stop-the-world section.
+
+   This relies on every domain beginning a major slice, a minor
+   collection or its termination before the marking phase can end.
+   The runtime does not guarantee this for the opportunistic major
+   work done while waiting at a barrier, hence this is
+   experimental. */
+
+/* Give their final class to the old pools that still hold a stale
+   young class, so that young classes can be reused without
+   ambiguity, and restore the ordering of the old ring (not-too-full
+   pools first). */
+/* ownership required: STW, domain */
+static void settle_old_pools(int dom_id)
 {
-  if (BOXROOT_DEBUG) validate_all_pools(dom_id);
+  pool_rings *local = pools[dom_id];
+  reclassify_ring(&local->old, dom_id, OLD);
+}
+
+/* ownership required: STW, domain */
+static void defer_old_pools(int dom_id)
+{
+  pool_rings *local = pools[dom_id];
+  reclassify_ring(&local->old, dom_id, PENDING);
+  STATS_INCR(total_deferred_scans);
+}
+
+#if CONCURRENT_MARKING
+
+/* Unlike scan_pool_gen, this can run outside of a STW section while
+   other domains deallocate from the pool, so the allocation count
+   cannot be trusted and the whole pool is scanned. A slot being
+   deallocated concurrently either still holds its value, which the
+   deletion barrier darkens anyway, or is a member of the free
+   list. */
+/* ownership required: domain */
+static int darken_pool(pool *pl)
+{
+  for (int i = 0; i < pool_capacity(pl); i++) {
+    bxr_slot s = pl->roots[i];
+    value v = s.as_value;
+    if (!is_pool_member(s, pl) && Is_block(v) && !Is_young(v))
+      caml_darken(Caml_state, v, NULL);
+  }
+  return pool_capacity(pl);
+}
+
+#endif
+
+/* ownership required: domain */
+static int darken_pending_pools(int dom_id)
+{
+#if CONCURRENT_MARKING
+  pool_rings *local = pools[dom_id];
+  if (local == NULL || local->pending == NULL) return 0;
+  int work = 0;
+  /* Darken before reclassifying, so that the deletion barrier
+     remains active on a pool until it has been darkened. */
+  pool *start_pool = local->pending;
+  pool *p = start_pool;
+  do {
+    work += darken_pool(p);
+    p = p->next;
+  } while (p != start_pool);
+  reclassify_ring(&local->pending, dom_id, OLD);
+  return work;
+#else
+  (void)dom_id;
+  return 0;
+#endif
+}
+
+/* }}} */
+
+/* {{{ Groups */
+
+/* ownership required: none */
+static bool owns_group(group *g)
+{
+  return bxr_domain_lock_held() && load_relaxed(&g->domain_id) == Domain_id;
+}
+
+/* Let the pool of a group hold young values. Its roots cannot be
+   reallocated to another pool, so instead the pool is moved back to
+   the young ring, until the next minor collection. */
+/* ownership required: domain of the group */
+static void rejuvenate_group_pool(pool *p, int dom_id)
+{
+  if (pool_class(p) == YOUNG) return;
+#if CONCURRENT_MARKING
+  /* It leaves the pending ring: darken it first. */
+  if (p->free_list.class == PENDING) darken_pool(p);
+#endif
+  reclassify_pool(ring_source(dom_id, &p), dom_id, YOUNG);
+}
+
+/* ownership required: root, current domain */
+static bool group_pool_accept_young(pool *p, boxroot root, value v)
+{
+  if (!owns_group(p->group)) { errno = EPERM; return false; }
+  rejuvenate_group_pool(p, Domain_id);
+  root->contents.as_value = v;
+  return true;
+}
+
+/* Initialize Boxroot and the pool rings of the current domain if
+   needed. Return false on failure. */
+/* ownership required: current domain */
+static bool setup_current_domain()
+{
+  if (Caml_state_opt == NULL) { errno = EPERM; return false; }
+  if (!BXR_MULTITHREAD && Domain_id != 0) { errno = EPERM; return false; }
+  if (0 == setup()) return false;
+  /* In OCaml 4, a thread in a blocking section has a domain state
+     but not the lock. Tested after setup, which installs the hooks
+     that track it. */
+  if (!bxr_domain_lock_held()) { errno = EPERM; return false; }
+#if !OCAML_MULTICORE
+  if (!bxr_check_thread_hooks()) {
+    status = BOXROOT_INVALID;
+    return false;
+  }
+#endif
+  int dom_id = Domain_id;
+  if (!has_pool_rings(dom_id)) init_pool_rings(dom_id);
+  if (!has_pool_rings(dom_id)) return false; /* ENOMEM */
+  if (bxr_cached_dom_id == -1) bxr_cached_dom_id = dom_id;
+  return true;
+}
+
+/* ownership required: current domain */
+boxroot_group boxroot_group_create()
+{
+  if (!setup_current_domain()) return NULL;
+  int dom_id = Domain_id;
+  group *g = malloc(sizeof(group));
+  if (g == NULL) return NULL; /* ENOMEM */
+  g->public.fl = &empty_fl;
+  store_relaxed(&g->domain_id, dom_id);
+  g->pools = NULL;
+  g->next_released = NULL;
+  return &g->public;
+}
+
+/* ownership required: current domain */
+boxroot bxr_create_in_slow(boxroot_group gr, value init)
+{
+  STATS_INCR(total_create_slow);
+  group *g = (group *)gr;
+  if (!owns_group(g)) { errno = EPERM; return NULL; }
+  int dom_id = Domain_id;
+  if (bxr_cached_dom_id == -1) bxr_cached_dom_id = dom_id;
+  pool *p = (g->public.fl == &empty_fl) ? NULL : (pool *)g->public.fl;
+  if (p != NULL && !is_full_pool(p)) {
+    /* The pool has been promoted since the last allocation. */
+    rejuvenate_group_pool(p, dom_id);
+  } else {
+    /* The group needs a new pool. We do not look for free slots in
+       the other pools of the group: these are reclaimed when the
+       group is released. */
+    p = take_empty_pool(dom_id, false);
+    if (p == NULL) return NULL; /* ENOMEM */
+    p->group = g;
+    p->group_next = g->pools;
+    g->pools = p;
+    g->public.fl = &p->free_list;
+    pool *q = p;
+    reclassify_pool(&q, dom_id, YOUNG);
+  }
+  /* Try again */
+  return boxroot_create_in(gr, init);
+}
+
+extern inline boxroot boxroot_create_in(boxroot_group g, value init);
+
+/* Hand back the pools of the group to the free ring in one step per
+   pool, and free the group. */
+/* ownership required: domain of the group */
+static void release_group_pools(group *g, int dom_id)
+{
+  pool *p = g->pools;
+  while (p != NULL) {
+    pool *next = p->group_next;
+#if CONCURRENT_MARKING
+    /* The roots are deleted: the deletion barrier applies. */
+    if (p->free_list.class == PENDING) darken_pool(p);
+#endif
+    p->group = NULL;
+    p->group_next = NULL;
+    /* Uninitialised, see init_free_list */
+    p->free_list.next = NULL;
+    p->free_list.alloc_count = 0;
+    reclassify_pool(ring_source(dom_id, &p), dom_id, UNTRACKED);
+    p = next;
+  }
+  free(g);
+}
+
+/* ownership required: group */
+void boxroot_group_release(boxroot_group gr)
+{
+  group *g = (group *)gr;
+  if (g->pools == NULL) {
+    free(g);
+  } else if (owns_group(g)) {
+    release_group_pools(g, Domain_id);
+  } else {
+    bxr_mutex_lock(&orphan_mutex);
+    g->next_released = released_groups;
+    released_groups = g;
+    bxr_mutex_unlock(&orphan_mutex);
+  }
+}
+
+/* }}} */
+
+/* {{{ Arrays */
+
+/* ownership required: list */
+static void array_unlink(array *a)
+{
+  *a->prevp = a->next;
+  if (a->next != NULL) a->next->prevp = a->prevp;
+}
+
+/* ownership required: list */
+static void array_push(array *a, array **list)
+{
+  a->next = *list;
+  if (*list != NULL) (*list)->prevp = &a->next;
+  a->prevp = list;
+  *list = a;
+}
+
+/* Move the arrays of [*source] to [*target] and give them to the
+   domain [dom_id] (-1 when orphaning them). */
+/* ownership required: lists, orphan_mutex */
+static void move_arrays(array **source, array **target, int dom_id)
+{
+  while (*source != NULL) {
+    array *a = *source;
+    array_unlink(a);
+    store_relaxed(&a->domain_id, dom_id);
+    array_push(a, target);
+  }
+}
+
+/* ownership required: list */
+static void free_arrays(array **list)
+{
+  while (*list != NULL) {
+    array *a = *list;
+    array_unlink(a);
+    free(a);
+  }
+}
+
+/* ownership required: none */
+static bool owns_array(array *a)
+{
+  return bxr_domain_lock_held() && load_relaxed(&a->domain_id) == Domain_id;
+}
+
+/* ownership required: domain of the array */
+static void set_array_class(array *a, int dom_id, int cl)
+{
+  pool_rings *local = pools[dom_id];
+  array_unlink(a);
+  a->public.class = cl;
+  array_push(a, (cl == YOUNG) ? &local->young_arrays : &local->old_arrays);
+}
+
+static size_t array_bytes(size_t n)
+{
+  return offsetof(array, public) + sizeof(struct bxr_array_private)
+    + n * sizeof(value);
+}
+
+static bool check_array_size(size_t n)
+{
+  if (n <= (SIZE_MAX - array_bytes(0)) / sizeof(value)) return true;
+  errno = ENOMEM;
+  return false;
+}
+
+/* ownership required: current domain */
+boxroot_array boxroot_array_create(size_t n)
+{
+  if (!setup_current_domain() || !check_array_size(n)) return NULL;
+  int dom_id = Domain_id;
+  array *a = malloc(array_bytes(n));
+  if (a == NULL) return NULL; /* ENOMEM */
+  store_relaxed(&a->domain_id, dom_id);
+  store_relaxed(&a->deleted, false);
+  a->public.size = n;
+  /* Arrays are often filled right after their creation */
+  a->public.class = YOUNG;
+  value *items = Bxr_array_items(&a->public);
+  for (size_t i = 0; i < n; i++) items[i] = Val_unit;
+  array_push(a, &pools[dom_id]->young_arrays);
+  return &a->public;
+}
+
+extern inline size_t boxroot_array_size(boxroot_array a);
+extern inline value boxroot_array_get(boxroot_array a, size_t i);
+extern inline value const * boxroot_array_get_ref(boxroot_array a, size_t i);
+
+/* ownership required: array, current domain */
+bool bxr_array_set_slow(boxroot_array ar, size_t i, value v)
+{
+  if (Is_block(v) && Is_young(v)) {
+    /* The array is old. Like the pools of groups, it is moved back
+       to the young arrays until the next minor collection. */
+    array *a = Array_val(ar);
+    if (!owns_array(a)) { errno = EPERM; return false; }
+    set_array_class(a, Domain_id, YOUNG);
+  }
+  Bxr_array_items(ar)[i] = v;
+  return true;
+}
+
+extern inline bool boxroot_array_set(boxroot_array a, size_t i, value v);
+
+/* ownership required: array, current domain */
+bool boxroot_array_resize(boxroot_array *ar, size_t n)
+{
+  array *a = Array_val(*ar);
+  if (!owns_array(a)) { errno = EPERM; return false; }
+  if (!check_array_size(n)) return false;
+  size_t old_size = a->public.size;
+  a = realloc(a, array_bytes(n));
+  if (a == NULL) return false; /* ENOMEM */
+  /* The array might have moved */
+  *a->prevp = a;
+  if (a->next != NULL) a->next->prevp = &a->next;
+  value *items = Bxr_array_items(&a->public);
+  for (size_t i = old_size; i < n; i++) items[i] = Val_unit;
+  a->public.size = n;
+  *ar = &a->public;
+  return true;
+}
+
+/* ownership required: array */
+void boxroot_array_delete(boxroot_array ar)
+{
+  array *a = Array_val(ar);
+  if (owns_array(a)) {
+    array_unlink(a);
+    free(a);
+  } else {
+    atomic_store_explicit(&a->deleted, true, memory_order_release);
+  }
+}
+
+/* ownership required: STW */
+static int scan_array(scanning_action action, int only_young,
+                      void *data, array *a)
+{
+  value *items = Bxr_array_items(&a->public);
+  size_t n = a->public.size;
+  for (size_t i = 0; i < n; i++) {
+    value v = items[i];
+    if (Is_block(v) && (!only_young || Is_young(v)))
+      CALL_GC_ACTION(action, data, v, &items[i]);
+  }
+  return (int)n;
+}
+
+/* Scan a list of arrays, and free the arrays deleted remotely. */
+/* ownership required: STW */
+static int scan_array_list(scanning_action action, int only_young,
+                           void *data, array **list)
+{
+  int work = 0;
+  array *a = *list;
+  while (a != NULL) {
+    array *next = a->next;
+    if (load_acquire(&a->deleted)) {
+      array_unlink(a);
+      free(a);
+    } else {
+      work += scan_array(action, only_young, data, a);
+    }
+    a = next;
+  }
+  return work;
+}
+
+/* ownership required: STW */
+static int scan_arrays(scanning_action action, int only_young,
+                       void *data, int dom_id)
+{
+  pool_rings *local = pools[dom_id];
+  int work = scan_array_list(action, only_young, data, &local->young_arrays);
+  if (!only_young)
+    work += scan_array_list(action, 0, data, &local->old_arrays);
+  return work;
+}
+
+/* ownership required: domain */
+static void promote_young_arrays(int dom_id)
+{
+  pool_rings *local = pools[dom_id];
+  while (local->young_arrays != NULL)
+    set_array_class(local->young_arrays, dom_id, OLD);
+}
+
+/* }}} */
+
+/* {{{ Intrusive cells */
+
+static_assert(alignof(boxroot_cell) >= 4, "cells are insufficiently aligned");
+static_assert(CELL_CHUNK_CAPACITY >= 1, "cell chunk size too small");
+
+/* ownership required: registry */
+static void free_cell_slot(cell_registry *r, uintptr_t *s)
+{
+  *s = (uintptr_t)r->free | 1;
+  r->free = s;
+}
+
+/* Add the unused slots of a chunk of the registry to its free
+   list. Return the number of cells registered in the chunk. */
+/* ownership required: registry */
+static int collect_free_cell_slots(cell_registry *r, cell_chunk *k)
+{
+  int live = 0;
+  for (int i = CELL_CHUNK_CAPACITY - 1; i >= 0; i--) {
+    if (Is_cell(k->slots[i])) live++;
+    else free_cell_slot(r, &k->slots[i]);
+  }
+  return live;
+}
+
+/* ownership required: registry */
+static bool add_cell_chunk(cell_registry *r, int dom_id)
+{
+  cell_chunk *k = (cell_chunk *)bxr_alloc_uninitialised_pool(CELL_CHUNK_SIZE);
+  if (k == NULL) return false;
+  k->domain_id = dom_id;
+  k->next = r->chunks;
+  r->chunks = k;
+  for (int i = 0; i < CELL_CHUNK_CAPACITY; i++) k->slots[i] = CELL_TOMBSTONE;
+  collect_free_cell_slots(r, k);
+  return true;
+}
+
+/* ownership required: registry, cell */
+static bool register_cell(cell_registry *r, int dom_id, boxroot_cell *c)
+{
+  if (r->free == NULL && !add_cell_chunk(r, dom_id)) return false;
+  uintptr_t *s = r->free;
+  r->free = (uintptr_t *)(*s & ~(uintptr_t)1);
+  *s = (uintptr_t)c;
+  c->bxr_slot = (uintptr_t)s | (uintptr_t)r->class;
+  return true;
+}
+
+/* Move the chunks of [*source] to [*target] and give them to the
+   domain [dom_id] (-1 when orphaning them). */
+/* ownership required: registries, STW */
+static void move_cell_chunks(cell_registry *source, cell_registry *target,
+                             int dom_id)
+{
+  while (source->chunks != NULL) {
+    cell_chunk *k = source->chunks;
+    source->chunks = k->next;
+    k->domain_id = dom_id;
+    k->next = target->chunks;
+    target->chunks = k;
+    collect_free_cell_slots(target, k);
+  }
+  source->free = NULL;
+}
+
+/* ownership required: registry */
+static void free_cell_chunks(cell_registry *r)
+{
+  while (r->chunks != NULL) {
+    cell_chunk *k = r->chunks;
+    r->chunks = k->next;
+    bxr_free_pool((pool *)k);
+  }
+  r->free = NULL;
+}
+
+/* ownership required: cell, current domain */
+bool boxroot_cell_register(boxroot_cell *c, value v)
+{
+  if (!setup_current_domain()) return false;
+  int dom_id = Domain_id;
+  pool_rings *local = pools[dom_id];
+  bool young = Is_block(v) && Is_young(v);
+  if (!register_cell(young ? &local->young_cells : &local->old_cells,
+                     dom_id, c))
+    return false; /* ENOMEM */
+  c->bxr_contents = v;
+  return true;
+}
+
+extern inline value boxroot_cell_get(boxroot_cell const *c);
+extern inline value const * boxroot_cell_get_ref(boxroot_cell const *c);
+
+/* ownership required: cell, current domain */
+bool bxr_cell_set_slow(boxroot_cell *c, value v)
+{
+  if (Is_block(v) && Is_young(v)) {
+    /* The cell is old: move it to the young cells. */
+    uintptr_t *s = Cell_slot(c);
+    int dom_id = Domain_id;
+    if (Cell_chunk(s)->domain_id != dom_id) { errno = EPERM; return false; }
+    pool_rings *local = pools[dom_id];
+    if (!register_cell(&local->young_cells, dom_id, c)) return false;
+    free_cell_slot(&local->old_cells, s);
+  }
+  c->bxr_contents = v;
+  return true;
+}
+
+extern inline bool boxroot_cell_set(boxroot_cell *c, value v);
+
+/* ownership required: cell, any domain */
+void boxroot_cell_unregister(boxroot_cell *c)
+{
+  uintptr_t *s = Cell_slot(c);
+  int dom_id = Domain_id;
+  if (Cell_chunk(s)->domain_id == dom_id) {
+    pool_rings *local = pools[dom_id];
+    bool young = Bxr_cell_class(c) == YOUNG;
+    free_cell_slot(young ? &local->young_cells : &local->old_cells, s);
+  } else {
+    /* Only free slots are ever written by their domain outside of
+       STW sections. */
+    *s = CELL_TOMBSTONE;
+  }
+}
+
+/* Scan a registry. With [compact], also rebuild its free list,
+   reclaiming the tombstones, and free its empty chunks. */
+/* ownership required: STW */
+static int scan_cell_registry(scanning_action action, int only_young,
+                              void *data, cell_registry *r, bool compact)
+{
+  int work = 0;
+  if (compact) r->free = NULL;
+  cell_chunk **k = &r->chunks;
+  while (*k != NULL) {
+    cell_chunk *chunk = *k;
+    int live = 0;
+    for (int i = 0; i < CELL_CHUNK_CAPACITY; i++) {
+      uintptr_t x = chunk->slots[i];
+      if (!Is_cell(x)) continue;
+      live++;
+      boxroot_cell *c = (boxroot_cell *)x;
+      value v = c->bxr_contents;
+      if (Is_block(v) && (!only_young || Is_young(v)))
+        CALL_GC_ACTION(action, data, v, &c->bxr_contents);
+    }
+    work += CELL_CHUNK_CAPACITY;
+    if (compact && live == 0) {
+      *k = chunk->next;
+      bxr_free_pool((pool *)chunk);
+      continue;
+    }
+    if (compact) collect_free_cell_slots(r, chunk);
+    k = &chunk->next;
+  }
+  return work;
+}
+
+/* ownership required: STW */
+static int scan_cells(scanning_action action, int only_young,
+                      void *data, int dom_id)
+{
+  pool_rings *local = pools[dom_id];
+  int work = scan_cell_registry(action, only_young, data,
+                                &local->young_cells, false);
+  if (!only_young)
+    work += scan_cell_registry(action, 0, data, &local->old_cells, true);
+  return work;
+}
+
+/* Move the young cells to the old registry. A cell that cannot be
+   moved for lack of memory remains young. */
+/* ownership required: domain */
+static void promote_young_cells(int dom_id)
+{
+  pool_rings *local = pools[dom_id];
+  cell_registry *young = &local->young_cells;
+  young->free = NULL;
+  for (cell_chunk *k = young->chunks; k != NULL; k = k->next) {
+    for (int i = CELL_CHUNK_CAPACITY - 1; i >= 0; i--) {
+      uintptr_t x = k->slots[i];
+      if (!Is_cell(x)
+          || register_cell(&local->old_cells, dom_id, (boxroot_cell *)x))
+        free_cell_slot(young, &k->slots[i]);
+    }
+  }
+}
+
+/* }}} */
+
+/* {{{ Weak roots */
+
+/* ownership required: current domain */
+boxroot_weak boxroot_weak_create(value init)
+{
+  if (!setup_current_domain()) return NULL;
+  int dom_id = Domain_id;
+  pool *p = pools[dom_id]->weak;
+  if (p == NULL || is_full_pool(p)) {
+    p = take_empty_pool(dom_id, false);
+    if (p == NULL) return NULL; /* ENOMEM */
+    /* It becomes the head of the ring, being empty */
+    pool *q = p;
+    reclassify_pool(&q, dom_id, WEAK);
+  }
+  bxr_slot_ref new_root = p->free_list.next;
+  p->free_list.next = new_root->as_slot_ref;
+  p->free_list.alloc_count++;
+  new_root->as_value = init;
+  return (boxroot_weak)new_root;
+}
+
+/* Read barrier: during marking, the value must survive the current
+   cycle since it can be stored in a place that has already been
+   marked; once found dead, it must not be resurrected. */
+/* ownership required: current domain */
+value boxroot_weak_get(boxroot_weak w)
+{
+  value v = *(value *)w;
+  if (v == BOXROOT_WEAK_EMPTY || !Is_block(v) || Is_young(v)) return v;
+  if (bxr_marking_in_progress()) bxr_darken(v);
+  else if (bxr_is_dead(v)) return BOXROOT_WEAK_EMPTY;
+  return v;
+}
+
+extern inline void boxroot_weak_delete(boxroot_weak w);
+
+/* ownership required: STW */
+static void clear_weak_pool(pool *pl)
+{
+  bxr_mutex_lock(&pl->mutex);
+  for (int i = 0; i < pool_capacity(pl); i++) {
+    bxr_slot_ref s = &pl->roots[i];
+    if (is_pool_member(*s, pl)) continue;
+    value v = s->as_value;
+    if (v != BOXROOT_WEAK_EMPTY && Is_block(v) && bxr_is_dead(v))
+      s->as_value = BOXROOT_WEAK_EMPTY;
+  }
+  bxr_mutex_unlock(&pl->mutex);
+}
+
+/* ownership required: ring, STW */
+static void update_weak_ring(pool *ring, void (*update)(pool *))
+{
+  if (ring == NULL) return;
+  pool *p = ring;
+  do {
+    update(p);
+    p = p->next;
+  } while (p != ring);
+}
+
+/* The weak pools of terminated domains are cleared even before they
+   are adopted, since the values they point to can die in the
+   meantime. Clearing a pool twice is harmless. */
+/* ownership required: STW */
+static void update_orphaned_weak_pools(void (*update)(pool *))
+{
+  if (!load_relaxed(&weak_orphans)) return;
+  bxr_mutex_lock(&orphan_mutex);
+  bool remaining = false;
+  for (int i = 0; i <= Num_domains; i++) {
+    update_weak_ring(orphan[i].weak, update);
+    remaining = remaining || orphan[i].weak != NULL;
+  }
+  store_relaxed(&weak_orphans, remaining);
+  bxr_mutex_unlock(&orphan_mutex);
+}
+
+/* Scan a ring of weak pools for an action other than marking, e.g.
+   compaction. Cleared roots are skipped. With [only_young], only the
+   young values are scanned: weak roots keep their young values alive
+   until they are promoted, since there is no safe point to tell
+   whether a young value died once the minor collection is over. */
+/* ownership required: ring, STW */
+static int scan_weak_ring(scanning_action action, int only_young,
+                          void *data, pool *ring)
+{
+  if (ring == NULL) return 0;
+  int work = 0;
+  pool *pl = ring;
+  do {
+    bxr_mutex_lock(&pl->mutex);
+    for (int i = 0; i < pool_capacity(pl); i++) {
+      bxr_slot_ref s = &pl->roots[i];
+      value v = s->as_value;
+      if (is_pool_member(*s, pl) || v == BOXROOT_WEAK_EMPTY || !Is_block(v)
+          || (only_young && !Is_young(v)))
+        continue;
+      CALL_GC_ACTION(action, data, v, &s->as_value);
+    }
+    bxr_mutex_unlock(&pl->mutex);
+    work += pool_capacity(pl);
+    pl = pl->next;
+  } while (pl != ring);
+  return work;
+}
+
+/* Promote the young values of the weak pools of terminated domains,
+   which can be scanned by any domain. Scanning a pool twice is
+   harmless, since its values are no longer young. */
+/* ownership required: STW */
+static void promote_orphaned_weak_pools(scanning_action action, void *data)
+{
+  if (!load_relaxed(&weak_orphans)) return;
+  bxr_mutex_lock(&orphan_mutex);
+  for (int i = 0; i <= Num_domains; i++)
+    scan_weak_ring(action, 1, data, orphan[i].weak);
+  bxr_mutex_unlock(&orphan_mutex);
+}
+
+/* }}} */
+
+/* {{{ Permanent roots */
+
+/* ownership required: current domain */
+boxroot_permanent boxroot_create_permanent(value init)
+{
+  if (!setup_current_domain()) return NULL;
+  int dom_id = Domain_id;
+  pool_rings *local = pools[dom_id];
+  pool *p = local->permanent;
+  if (p == NULL || is_full_pool(p)) {
+    p = take_empty_pool(dom_id, true);
+    if (p == NULL) return NULL; /* ENOMEM */
+    /* It becomes the head of the ring, being empty */
+    pool *q = p;
+    reclassify_pool(&q, dom_id, PERMANENT);
+  }
+  bxr_slot_ref new_root = p->free_list.next;
+  p->free_list.next = new_root->as_slot_ref;
+  p->free_list.alloc_count++;
+  new_root->as_value = init;
+  if (Is_block(init) && Is_young(init)) local->permanent_young = true;
+  return (boxroot_permanent)new_root;
+}
+
+extern inline value boxroot_permanent_get(boxroot_permanent r);
+
+/* Permanent roots are never deleted nor modified, so that once their
+   values have been promoted, they only need to be scanned at the
+   start of major collection. */
+/* ownership required: STW */
+static int scan_permanent_pools(scanning_action action, int only_young,
+                                void *data, int dom_id)
+{
+  pool_rings *local = pools[dom_id];
+  if (only_young && !local->permanent_young) return 0;
+  int work = scan_ring(action, only_young, data, &local->permanent);
+  if (bxr_in_minor_collection()) local->permanent_young = false;
+  return work;
+}
+
+/* }}} */
+
+/* {{{ Custom blocks */
+
+/* The finalisers of custom blocks run one block at a time, during
+   the sweeping of the major heap or at the end of minor collections
+   (in a STW section with OCaml 5). Instead of deleting each boxroot
+   there, possibly through the remote path, the finaliser queues it
+   for the current domain, and the queue is released with
+   boxroot_delete_many at the next major slice of the domain. */
+
+/* ownership required: current domain */
+static void release_finalised(int dom_id)
+{
+  finalised_queue *q = &finalised[dom_id];
+  if (q->count == 0) return;
+  boxroot_delete_many(q->roots, q->count);
+  q->count = 0;
+}
+
+/* ownership required: current domain */
+static void finalise_custom(value b)
+{
+  boxroot root = *boxroot_custom_root(b);
+  /* NULL if boxroot_custom_alloc failed */
+  if (root == NULL || boxroot_status() != BOXROOT_RUNNING) return;
+  finalised_queue *q = &finalised[Domain_id];
+  if (BXR_UNLIKELY(q->count == q->capacity)) {
+    size_t capacity = q->capacity == 0 ? 256 : 2 * q->capacity;
+    boxroot *roots = realloc(q->roots, capacity * sizeof(boxroot));
+    /* Out of memory: leak the boxroot rather than deleting it from
+       a finaliser. */
+    if (roots == NULL) return;
+    q->roots = roots;
+    q->capacity = capacity;
+  }
+  q->roots[q->count++] = root;
+  STATS_INCR(total_finalised);
+}
+
+struct custom_operations boxroot_custom_ops = {
+  "_boxroot",
+  finalise_custom,
+  custom_compare_default,
+  custom_hash_default,
+  custom_serialize_default,
+  custom_deserialize_default,
+  custom_compare_ext_default,
+  custom_fixed_length_default
+};
+
+/* ownership required: none */
+boxroot * boxroot_custom_root(value b)
+{
+  return (boxroot *)Data_custom_val(b);
+}
+
+/* ownership required: current domain */
+value boxroot_custom_alloc(value v)
+{
+  CAMLparam1(v);
+  CAMLlocal1(b);
+  /* The configuration is only known after setup. */
+  if (!setup_current_domain()) caml_raise_out_of_memory();
+  /* The block is allocated first, so that the root does not leak if
+     the allocation raises. Account for the share of a large pool
+     taken by the root. */
+  mlsize_t mem = config.pool_size / config.capacity[1];
+  b = caml_alloc_custom_mem(&boxroot_custom_ops, sizeof(boxroot), mem);
+  *boxroot_custom_root(b) = NULL;
+  boxroot root = boxroot_create(v);
+  if (BXR_UNLIKELY(root == NULL)) caml_raise_out_of_memory();
+  *boxroot_custom_root(b) = root;
+  CAMLreturn(b);
+}
+
+/* }}} */
+
+/* {{{ Work sharing */
+
+/* With SHARED_SCANNING, during a minor collection, a domain with
+   many young pools publishes them in its work descriptor, and every
+   domain that is done with its own roots claims and scans some of
+   them with its own scanning action. This is allowed since in OCaml
+   5 any domain participating in a minor collection can promote any
+   young value. The owner waits until all of its pools have been
+   scanned before promoting them. Descriptors are never reused within
+   one minor collection, and a helper cannot outlive the STW section
+   it started in, so a helper either claims a pool of the current
+   publication or finds nothing left to claim. */
+
+/* Below this number of young pools, scan alone. */
+#define SHARED_SCANNING_MIN_POOLS 8
+
+/* Number of iterations the owner spins before yielding while it
+   waits for the helpers. */
+#define SHARED_SCANNING_SPINS 1000
+
+typedef struct {
+  /* Pools to scan. Owned by the domain, read by helpers after
+     acquiring [size]. */
+  pool **pools;
+  int capacity;
+  /* Number of published pools (0 if none). */
+  atomic_int size;
+  /* Index of the next pool to claim. */
+  atomic_int next;
+  /* Number of pools scanned. */
+  atomic_int done;
+} work_descr;
+
+static work_descr *shared_work = NULL;
+
+// returns the amount of work done
+/* ownership required: STW */
+static int claim_and_scan(scanning_action action, void *data,
+                          work_descr *w, int size)
+{
+  int work = 0;
+  int i;
+  while ((i = atomic_fetch_add_explicit(&w->next, 1,
+                                        memory_order_relaxed)) < size) {
+    work += scan_pool(action, 1, data, w->pools[i]);
+    /* Synchronise with the owner waiting for completion */
+    atomic_fetch_add_explicit(&w->done, 1, memory_order_release);
+  }
+  return work;
+}
+
+/* Scan the young pools of [dom_id], sharing the work with other
+   domains if there are many of them. Return -1 if the pools could
+   not be published, in which case they must be scanned normally. */
+/* ownership required: STW, domain */
+static int scan_young_pools_shared(scanning_action action, void *data,
+                                   int dom_id)
+{
+  pool *start_pool = pools[dom_id]->young;
+  if (start_pool == NULL) return 0;
+  work_descr *w = &shared_work[dom_id];
+  int n = 0;
+  pool *p = start_pool;
+  do {
+    if (n == w->capacity) {
+      int capacity = (n == 0) ? 64 : 2 * n;
+      pool **new_pools = realloc(w->pools, capacity * sizeof(pool *));
+      if (new_pools == NULL) return -1;
+      w->pools = new_pools;
+      w->capacity = capacity;
+    }
+    w->pools[n++] = p;
+    p = p->next;
+  } while (p != start_pool);
+  if (n < SHARED_SCANNING_MIN_POOLS) return -1;
+  store_relaxed(&w->next, 0);
+  store_relaxed(&w->done, 0);
+  atomic_store_explicit(&w->size, n, memory_order_release);
+  int work = claim_and_scan(action, data, w, n);
+  /* Wait for the helpers to finish the pools they claimed. Each of
+     them has at most one pool left to scan, but it may have been
+     descheduled. */
+  for (int spins = 0; load_acquire(&w->done) < n; spins++) {
+    if (spins < SHARED_SCANNING_SPINS) bxr_cpu_relax();
+    else sched_yield();
+  }
+  store_relaxed(&w->size, 0);
+  return work;
+}
+
+// returns the amount of work done
+/* ownership required: STW */
+static int help_scan_young_pools(scanning_action action, void *data,
+                                 int dom_id)
+{
+  int work = 0;
+  for (int i = 0; i < Num_domains; i++) {
+    if (i == dom_id) continue;
+    work_descr *w = &shared_work[i];
+    int size = load_acquire(&w->size);
+    if (size != 0) work += claim_and_scan(action, data, w, size);
+  }
+  return work;
+}
+
+/* }}} */
+
+/* {{{ Root scanning */
+
+/* ownership required: STW */
+static void scan_roots(scanning_action action, int only_young,
+                       void *data, int dom_id)
+{
+  if (BOXROOT_DEBUG) validate_all_pools(dom_id);
+  bool defer_old = false;
+  if (CONCURRENT_MARKING) {
+    if (only_young) {
+      /* A minor collection during marking */
+      int work = darken_pending_pools(dom_id);
+      if (STATS) stats.total_scanning_work_pending += work;
+    }
+#if CONCURRENT_MARKING
+    defer_old = (action == &caml_darken);
+#endif
+  }
   move_current_to_young(dom_id);
   /* First perform all the delayed deallocations. */
   gc_pool_rings(dom_id);
-  /* The first domain arriving there will take ownership of the pools
-     of terminated domains. */
+  /* Take ownership of the pools of terminated domains that were
+     given to us. The first domain arriving there also takes the ones
+     that could not be given to any domain. */
   adopt_orphaned_pools(dom_id);
-  int work = scan_pools(action, only_young, data, dom_id);
+  int work = -1;
+  if (SHARED_SCANNING && only_young)
+    work = scan_young_pools_shared(action, data, dom_id);
+  if (work < 0 && defer_old) {
+    /* Pools left pending at the end of the previous cycle (if any) are
+       deferred again. */
+    reclassify_ring(&pools[dom_id]->pending, dom_id, OLD);
+    work = scan_ring(action, 0, data, &pools[dom_id]->young);
+    defer_old_pools(dom_id);
+  }
+  if (work < 0) work = scan_pools(action, only_young, data, dom_id);
+  work += scan_arrays(action, only_young, data, dom_id);
+  work += scan_cells(action, only_young, data, dom_id);
+  work += scan_permanent_pools(action, only_young, data, dom_id);
+  /* Weak pools are not marked: they are cleared instead, at the start
+     of the cycle (OCaml 5) or at the end of marking (OCaml 4, see
+     marking_end_callback). */
+  if (only_young || action != (scanning_action)&caml_darken)
+    work += scan_weak_ring(action, only_young, data, pools[dom_id]->weak);
+  else if (OCAML_MULTICORE)
+    update_weak_ring(pools[dom_id]->weak, clear_weak_pool);
   if (bxr_in_minor_collection()) {
     promote_young_pools(dom_id);
+    promote_young_arrays(dom_id);
+    promote_young_cells(dom_id);
   } else {
-    free_pool_ring(&pools[dom_id]->free);
+    settle_old_pools(dom_id);
+    release_free_pools(dom_id);
   }
   if (STATS) {
     if (only_young) stats.total_scanning_work_minor += work;
@@ -1023,7 +2968,7 @@ static long long time_counter(void)
 // unit: 1=KiB, 2=MiB
 static long long kib_of_pools(long long count, int unit)
 {
-  int log_per_pool = BXR_POOL_LOG_SIZE - unit * 10;
+  int log_per_pool = config.pool_log_size - unit * 10;
   if (log_per_pool >= 0) return count << log_per_pool;
   else return count >> -log_per_pool;
 }
@@ -1044,12 +2989,14 @@ void boxroot_print_stats()
 
   if (stats.total_alloced_pools == 0) return;
 
-  printf("BXR_POOL_LOG_SIZE: %d (%'lld KiB, %'d roots/pool)\n"
+  printf("pool log size: %d (%'lld KiB, %'d roots/pool)\n"
+         "small pools: %'d roots/pool\n"
          "BOXROOT_DEBUG: %d\n"
          "OCAML_MULTICORE: %d\n"
          "BXR_MULTITHREAD: %d\n"
          "BXR_FORCE_REMOTE: %d\n",
-         (int)BXR_POOL_LOG_SIZE, kib_of_pools(1, 1), (int)POOL_CAPACITY,
+         config.pool_log_size, kib_of_pools(1, 1), config.capacity[1],
+         config.capacity[0],
          (int)BOXROOT_DEBUG, (int)OCAML_MULTICORE,
          (int)BXR_MULTITHREAD, (int)BXR_FORCE_REMOTE);
 
@@ -1066,6 +3013,14 @@ void boxroot_print_stats()
          stats.total_freed_pools,
          kib_of_pools(stats.total_freed_pools, 2));
 
+  long long allocated = allocated_pool_count();
+  printf("allocated pools: %'lld (%'lld MiB)\n"
+         "soft memory limit reached: %'lld times\n"
+         "allocations denied by the hard memory limit: %'lld\n",
+         allocated, kib_of_pools(allocated, 2),
+         stats.soft_limit_events,
+         stats.hard_limit_failures);
+
   double scanning_work_minor =
     average(stats.total_scanning_work_minor, stats.minor_collections);
   double scanning_work_major =
@@ -1082,6 +3037,13 @@ void boxroot_print_stats()
   printf("work per minor: %'.0f\n"
          "work per major: %'.0f\n"
          "total scanning work: %'lld (%'lld minor, %'lld major)\n"
+#if SHARED_SCANNING
+         "minor scanning work done by helpers: %'lld\n"
+#endif
+#if CONCURRENT_MARKING
+         "major scans with deferred old pools: %'lld\n"
+         "work darkening pending pools: %'lld\n"
+#endif
 #if BOXROOT_DEBUG
          "young hits (non-minor collection): %.2f%%\n"
 #endif
@@ -1089,6 +3051,13 @@ void boxroot_print_stats()
          scanning_work_minor,
          scanning_work_major,
          total_scanning_work, stats.total_scanning_work_minor, stats.total_scanning_work_major,
+#if SHARED_SCANNING
+         stats.total_scanning_work_shared,
+#endif
+#if CONCURRENT_MARKING
+         stats.total_deferred_scans,
+         stats.total_scanning_work_pending,
+#endif
 #if BOXROOT_DEBUG
          young_hits_gen_pct,
 #endif
@@ -1116,12 +3085,16 @@ void boxroot_print_stats()
   printf("total boxroot_create_slow: %'lld\n"
          "total boxroot_delete_slow: %'lld\n"
          "total boxroot_modify_slow: %'lld\n"
+         "total boxroot_migrate: %'lld\n"
+         "total finalised custom blocks: %'lld\n"
          "total ring operations: %'lld\n"
          "ring operations per pool: %.2f\n"
          "total gc_pool_rings: %'lld\n",
          stats.total_create_slow,
          stats.total_delete_slow,
          stats.total_modify_slow,
+         stats.total_migrate,
+         stats.total_finalised,
          stats.ring_operations,
          ring_operations_per_pool,
          stats.total_gc_pool_rings);
@@ -1162,12 +3135,27 @@ static void scanning_callback(scanning_action action, int only_young,
   if (in_minor_collection) STATS_INCR(minor_collections);
   else STATS_INCR(major_collections);
   int dom_id = Domain_id;
-  if (pools[dom_id] == NULL) return; /* synchronised by domain lock */
+  /* synchronised by domain lock */
+  bool has_pools = pools[dom_id] != NULL;
+  if (OCAML_MULTICORE && only_young)
+    promote_orphaned_weak_pools(action, data);
+  if (OCAML_MULTICORE && !only_young
+      && action == (scanning_action)&caml_darken)
+    update_orphaned_weak_pools(clear_weak_pool);
+  bool help = SHARED_SCANNING && only_young && in_minor_collection;
+  if (!has_pools && !help) return;
 #if !OCAML_MULTICORE
   if (!bxr_check_thread_hooks()) status = BOXROOT_INVALID;
 #endif
   long long start = time_counter();
-  scan_roots(action, only_young, data, dom_id);
+  if (has_pools) scan_roots(action, only_young, data, dom_id);
+  if (help) {
+    int work = help_scan_young_pools(action, data, dom_id);
+    if (STATS) {
+      stats.total_scanning_work_minor += work;
+      stats.total_scanning_work_shared += work;
+    }
+  }
   long long duration = time_counter() - start;
   if (STATS) {
     atomic_llong *total = in_minor_collection ? &stats.total_minor_time : &stats.total_major_time;
@@ -1182,13 +3170,177 @@ static void scanning_callback(scanning_action action, int only_young,
 static void domain_termination_callback()
 {
   DEBUGassert(OCAML_MULTICORE == 1);
+  if (boxroot_status() != BOXROOT_RUNNING) return;
   int dom_id = Domain_id;
+  release_finalised(dom_id);
   orphan_pools(dom_id);
 }
 
+/* Release the boxroots of finalised custom blocks, and darken the
+   pending pools at the first major slice of the cycle */
+/* ownership required: current domain */
+static void major_slice_callback()
+{
+  if (boxroot_status() == BOXROOT_NOT_SETUP
+      || boxroot_status() == BOXROOT_TORE_DOWN) return;
+  int dom_id = Domain_id;
+  release_finalised(dom_id);
+  if (!CONCURRENT_MARKING) return;
+  int work = darken_pending_pools(dom_id);
+  if (STATS) stats.total_scanning_work_pending += work;
+}
+
+/* ownership required: STW */
+static void marking_end_callback()
+{
+  DEBUGassert(!OCAML_MULTICORE);
+  if (boxroot_status() != BOXROOT_RUNNING) return;
+  if (pools[0] != NULL) update_weak_ring(pools[0]->weak, clear_weak_pool);
+}
+
 /* Used for initialization/teardown */
 static mutex_t init_mutex = BXR_MUTEX_INITIALIZER;
 
+static const struct {
+  const char *env;
+  long min;
+  long max;
+} param_descr[BOXROOT_PARAM_COUNT] = {
+  [BOXROOT_PARAM_POOL_LOG_SIZE] =
+    { "BOXROOT_POOL_LOG_SIZE", BXR_POOL_MIN_LOG_SIZE, BXR_POOL_MAX_LOG_SIZE },
+  [BOXROOT_PARAM_DEALLOC_THRESHOLD] =
+    { "BOXROOT_DEALLOC_THRESHOLD", 1, (long)1 << 30 },
+  [BOXROOT_PARAM_LOW_WATER_PERCENT] =
+    { "BOXROOT_LOW_WATER_PERCENT", 0, 100 },
+  [BOXROOT_PARAM_RETAIN_MIN_POOLS] =
+    { "BOXROOT_RETAIN_MIN_POOLS", 0, INT_MAX },
+  [BOXROOT_PARAM_RETAIN_MAX_POOLS] =
+    { "BOXROOT_RETAIN_MAX_POOLS", 0, INT_MAX },
+  [BOXROOT_PARAM_RETAIN_DECAY] =
+    { "BOXROOT_RETAIN_DECAY", 1, INT_MAX },
+  [BOXROOT_PARAM_YOUNG_POOL_LOG_SIZE] =
+    { "BOXROOT_YOUNG_POOL_LOG_SIZE", BXR_POOL_MIN_LOG_SIZE, BXR_POOL_MAX_LOG_SIZE },
+};
+
+/* Values set with boxroot_configure, -1 if unset. Owned by
+   init_mutex. */
+static long param_value[BOXROOT_PARAM_COUNT] = { -1, -1, -1, -1, -1, -1, -1 };
+
+static bool valid_param_value(int param, long n)
+{
+  if (n < param_descr[param].min || n > param_descr[param].max) return false;
+  /* The threshold is used as a mask */
+  if (param == BOXROOT_PARAM_DEALLOC_THRESHOLD && (n & (n - 1)) != 0)
+    return false;
+  return true;
+}
+
+/* ownership required: none */
+bool boxroot_configure(int param, long n)
+{
+  if (param < 0 || param >= BOXROOT_PARAM_COUNT || !valid_param_value(param, n)) {
+    errno = EINVAL;
+    return false;
+  }
+  bool res = true;
+  bxr_mutex_lock(&init_mutex);
+  if (status != BOXROOT_NOT_SETUP) {
+    errno = EBUSY;
+    res = false;
+  } else {
+    param_value[param] = n;
+  }
+  bxr_mutex_unlock(&init_mutex);
+  return res;
+}
+
+/* The value of a parameter set with boxroot_configure, or else in the
+   environment, or else [dflt]. */
+/* ownership required: init_mutex */
+static long get_param(int param, long dflt)
+{
+  if (param_value[param] >= 0) return param_value[param];
+  const char *s = getenv(param_descr[param].env);
+  if (s == NULL || *s == '\0') return dflt;
+  char *end;
+  errno = 0;
+  long n = strtol(s, &end, 10);
+  if (errno != 0 || *end != '\0' || !valid_param_value(param, n)) return dflt;
+  return n;
+}
+
+/* ownership required: init_mutex */
+static void read_config()
+{
+  int log_size = get_param(BOXROOT_PARAM_POOL_LOG_SIZE, BXR_POOL_LOG_SIZE);
+  int small_log_size = get_param(BOXROOT_PARAM_YOUNG_POOL_LOG_SIZE, log_size);
+  if (small_log_size > log_size) small_log_size = log_size;
+  config.pool_log_size = log_size;
+  config.pool_size = (size_t)1 << log_size;
+  long percent = get_param(BOXROOT_PARAM_LOW_WATER_PERCENT, 50);
+  int log_sizes[2] = { small_log_size, log_size };
+  for (int i = 0; i < 2; i++) {
+    config.capacity[i] = Pool_capacity(log_sizes[i]);
+    config.low_water_count[i] =
+      (int)(((size_t)1 << log_sizes[i]) * percent / 100 / sizeof(bxr_slot));
+  }
+  config.retain_min_pools =
+    get_param(BOXROOT_PARAM_RETAIN_MIN_POOLS, BOXROOT_RETAIN_MIN_POOLS);
+  config.retain_max_pools =
+    get_param(BOXROOT_PARAM_RETAIN_MAX_POOLS, BOXROOT_RETAIN_MAX_POOLS);
+  config.retain_decay =
+    get_param(BOXROOT_PARAM_RETAIN_DECAY, BOXROOT_RETAIN_DECAY);
+  bxr_params.pool_mask = ~((uintptr_t)config.pool_size - 1);
+  bxr_params.dealloc_threshold =
+    get_param(BOXROOT_PARAM_DEALLOC_THRESHOLD, (long)config.pool_size / 2);
+}
+
+/* ownership required: init_mutex */
+static void free_domain_tables()
+{
+  free(pools);
+  free(orphan);
+  free(adopting_domain);
+  free(shared_work);
+  free(allocated_pools);
+  free(finalised);
+  pools = NULL;
+  orphan = NULL;
+  adopting_domain = NULL;
+  shared_work = NULL;
+  allocated_pools = NULL;
+  finalised = NULL;
+}
+
+/* Allocate the per-domain tables for the maximum number of domains
+   of the runtime. This number is fixed when the runtime starts, so
+   that the tables never need to grow. */
+/* ownership required: init_mutex */
+static bool alloc_domain_tables()
+{
+  int n = bxr_runtime_max_domains();
+  assert(n >= 1 && n <= Max_num_domains);
+  pools = calloc(n, sizeof(pool_rings *));
+  orphan = calloc(n + 1, sizeof(pool_rings));
+  adopting_domain = calloc(n, sizeof(bool));
+  shared_work = calloc(n, sizeof(work_descr));
+  size_t counters_size = (n + 1) * sizeof(pool_counter);
+  allocated_pools = aligned_alloc(alignof(pool_counter), counters_size);
+  finalised = calloc(n, sizeof(finalised_queue));
+  if (pools == NULL || orphan == NULL || adopting_domain == NULL
+      || shared_work == NULL || allocated_pools == NULL
+      || finalised == NULL) {
+    free_domain_tables();
+    errno = ENOMEM;
+    return false;
+  }
+  for (int i = 0; i <= n; i++) allocated_pools[i].count = 0;
+#if OCAML_MULTICORE
+  bxr_num_domains = n;
+#endif
+  return true;
+}
+
 /* ownership required: current domain */
 static bool setup()
 {
@@ -1199,7 +3351,14 @@ static bool setup()
     res = (status == BOXROOT_RUNNING);
     goto out;
   }
-  bxr_setup_hooks(&scanning_callback, &domain_termination_callback);
+  if (!alloc_domain_tables()) {
+    res = false;
+    goto out;
+  }
+  read_config();
+  bxr_setup_hooks(&scanning_callback, &domain_termination_callback,
+                  &major_slice_callback,
+                  OCAML_MULTICORE ? NULL : &marking_end_callback);
   // we are done
   status = BOXROOT_RUNNING;
   // fall through
@@ -1222,10 +3381,37 @@ void boxroot_teardown()
     pool_rings *ps = pools[i];
     if (ps == NULL) continue;
     free_pool_rings(ps);
+    free_arrays(&ps->young_arrays);
+    free_arrays(&ps->old_arrays);
+    free_cell_chunks(&ps->young_cells);
+    free_cell_chunks(&ps->old_cells);
     free(ps);
+    pools[i] = NULL;
     set_current_fl(i, &empty_fl);
   }
-  free_pool_rings(&orphan);
+  for (int i = 0; i <= Num_domains; i++) {
+    free_pool_rings(&orphan[i]);
+    free_arrays(&orphan[i].young_arrays);
+    free_arrays(&orphan[i].old_arrays);
+    free_cell_chunks(&orphan[i].young_cells);
+    free_cell_chunks(&orphan[i].old_cells);
+  }
+  while (released_groups != NULL) {
+    group *g = released_groups;
+    released_groups = g->next_released;
+    free(g);
+  }
+  for (int i = 0; i < Num_domains; i++) {
+    free(shared_work[i].pools);
+    /* The queued boxroots were freed with their pools */
+    free(finalised[i].roots);
+  }
+  free(bxr_pool_table);
+  bxr_pool_table = NULL;
+  pool_table_free = 0;
+  pool_table_fresh = 1;
+  /* The hooks stay installed, but do nothing once torn down. */
+  free_domain_tables();
   // fall through
  out:
   bxr_mutex_unlock(&init_mutex);
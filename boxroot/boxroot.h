@@ -3,9 +3,13 @@
 #define BOXROOT_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "ocaml_hooks.h"
 #include "platform.h"
 
+BXR_API_BEGIN
+
 /* `boxroot`s follow an ownership discipline. */
 typedef struct bxr_private* boxroot;
 
@@ -54,6 +58,244 @@ inline void boxroot_delete(boxroot);
 */
 inline bool boxroot_modify(boxroot *, value);
 
+/* `boxroot_migrate(&r)` moves the boxroot `r` to the pools of the
+   current domain, so that later calls to `boxroot_modify(&r,v)` and
+   `boxroot_delete(r)` from this domain take the local fast path. This
+   is useful when ownership of a long-lived boxroot is handed over to
+   a thread running on another domain: the remote deallocation is
+   paid once, at migration time. Migrating a boxroot that already
+   belongs to the current domain does nothing. As with
+   `boxroot_modify`, the pointer `r` may change.
+
+   The OCaml domain lock must be held before calling
+   `boxroot_migrate`.
+
+   A return value of `false` indicates that the migration could not
+   take place due to a failure of reallocation or because the domain
+   lock is not held (see `boxroot_status`). In this case `r` is left
+   unchanged and remains valid. */
+bool boxroot_migrate(boxroot *);
+
+/* `boxroot_reserve(n)` allocates in advance enough memory for the
+   current domain to create `n` boxroots without allocating memory,
+   so that this cost is not paid on a latency-sensitive path later
+   on. The reserved memory is kept by the GC until it has been used
+   by `n` creations. Successive reservations do not add up: the
+   largest one is kept.
+
+   The OCaml domain lock must be held before calling
+   `boxroot_reserve`.
+
+   A return value of `false` indicates a failure of allocation or
+   initialization of Boxroot (see `boxroot_status`). */
+bool boxroot_reserve(size_t);
+
+/* Bulk operations, for containers of boxroots that are filled or
+   freed all at once, and for bindings where each call has a cost.
+
+   `boxroot_create_many(vs, rs, n)` stores in `rs[i]` a new boxroot
+   initialised to `vs[i]`, for `i < n`. The OCaml domain lock must be
+   held. A return value of `false` indicates a failure of allocation
+   or initialization of Boxroot (see `boxroot_status`), in which case
+   no boxroot is left allocated.
+
+   `boxroot_delete_many(rs, n)` deallocates the boxroots `rs[0]`, …,
+   `rs[n-1]`, which must be non-null. It is equivalent to calling
+   `boxroot_delete` on each of them. (One does not need to hold the
+   OCaml domain lock; without it, consecutive boxroots allocated
+   together are released at the cost of a single deallocation.) */
+bool boxroot_create_many(value const *, boxroot *, size_t);
+void boxroot_delete_many(boxroot const *, size_t);
+
+/* Custom blocks owning a boxroot, for OCaml values that keep another
+   value alive (e.g. a binding holding an OCaml callback).
+
+   `boxroot_custom_alloc(v)` allocates a custom block with the
+   operations `boxroot_custom_ops`, owning a new boxroot initialised
+   to `v`. It raises `Out_of_memory` if the boxroot cannot be
+   allocated. The share of the pool used by the boxroot is accounted
+   for as memory held by the block (see `caml_alloc_custom_mem`).
+
+   `boxroot_custom_root(b)` returns a pointer to the boxroot owned by
+   the custom block `b`, to be used with `boxroot_get` and
+   `boxroot_modify`, but not `boxroot_delete`. The boxroot is `NULL`
+   if `boxroot_custom_alloc` raised after allocating the block. Once `b` is
+   unreachable, its finaliser queues the boxroot; the queue is
+   deleted in bulk at the next major slice of the domain.
+
+   The OCaml domain lock must be held before calling these
+   functions. */
+extern struct custom_operations boxroot_custom_ops;
+value boxroot_custom_alloc(value);
+boxroot * boxroot_custom_root(value);
+
+/* Weak boxroots. A `boxroot_weak` does not keep its value alive:
+   once the value is collected, `boxroot_weak_get` returns
+   `BOXROOT_WEAK_EMPTY` instead. Immediate values are never
+   collected.
+
+   Clearing is not immediate. A young value is kept alive by a weak
+   boxroot until the next minor collection promotes it. A value of the
+   major heap is cleared once it is found dead at the end of the
+   marking phase (OCaml 4), or when the roots are scanned at the start
+   of the next major cycle (OCaml 5). In the meantime,
+   `boxroot_weak_get` already returns `BOXROOT_WEAK_EMPTY` for it.
+   Conversely, a value obtained with `boxroot_weak_get` during marking
+   is kept alive until the end of the current major cycle.
+
+   `boxroot_weak_create(v)` allocates a new weak boxroot initialised
+   to the value `v`. The OCaml domain lock must be held. A return
+   value of `NULL` indicates a failure of allocation or
+   initialization of Boxroot (see `boxroot_status`).
+
+   `boxroot_weak_get(w)` returns the contained value or
+   `BOXROOT_WEAK_EMPTY`, subject to the usual discipline for
+   non-rooted values. The OCaml domain lock must be held.
+
+   `boxroot_weak_delete(w)` deallocates the weak boxroot `w`, with the
+   same requirements as `boxroot_delete`. */
+typedef struct bxr_weak_private* boxroot_weak;
+#define BOXROOT_WEAK_EMPTY ((value)0)
+boxroot_weak boxroot_weak_create(value);
+value boxroot_weak_get(boxroot_weak);
+inline void boxroot_weak_delete(boxroot_weak);
+
+/* Permanent boxroots, for data that stays alive until
+   `boxroot_teardown`, such as tables built at startup. A
+   `boxroot_permanent` can be neither modified nor deleted; in
+   exchange it costs nothing at minor collection once its value has
+   been promoted.
+
+   `boxroot_create_permanent(v)` allocates a new permanent boxroot
+   initialised to the value `v`. The OCaml domain lock must be held.
+   A return value of `NULL` indicates a failure of allocation or
+   initialization of Boxroot (see `boxroot_status`).
+
+   `boxroot_permanent_get(r)` returns the contained value, subject to
+   the usual discipline for non-rooted values. The OCaml domain lock
+   must be held. */
+typedef struct bxr_permanent_private* boxroot_permanent;
+boxroot_permanent boxroot_create_permanent(value);
+inline value boxroot_permanent_get(boxroot_permanent r) { return *(value *)r; }
+
+/* Compact boxroots. A `boxroot_compact` is a boxroot encoded in 32
+   bits, for memory-dense data structures, at the cost of two
+   additional loads on access. The value 0 is never a valid compact
+   boxroot.
+
+   `boxroot_compact_create`, `boxroot_compact_get`,
+   `boxroot_compact_get_ref`, `boxroot_compact_delete` and
+   `boxroot_compact_modify` behave like their counterparts for
+   `boxroot`, with the same requirements. `boxroot_compact_create`
+   returns 0 on failure (see `boxroot_status`), which includes having
+   compact boxroots in too many distinct pools at once. */
+typedef uint32_t boxroot_compact;
+boxroot_compact boxroot_compact_create(value);
+inline value boxroot_compact_get(boxroot_compact);
+inline value const * boxroot_compact_get_ref(boxroot_compact);
+inline void boxroot_compact_delete(boxroot_compact);
+inline bool boxroot_compact_modify(boxroot_compact *, value);
+
+/* Groups of boxroots can be released all at once.
+
+   `boxroot_group_create()` allocates a new empty group owned by the
+   current domain. A return value of `NULL` indicates a failure of
+   allocation or initialization of Boxroot (see `boxroot_status`).
+
+   `boxroot_create_in(g, v)` allocates a new boxroot initialised to
+   the value `v` in the group `g`, with the same cost as
+   `boxroot_create`. The boxroots of a group are used like any other
+   boxroot, except that deleting one is optional. The slot of a
+   deleted boxroot is reused by the next `boxroot_create_in` if it
+   belongs to the pool that the group is currently filling; otherwise
+   it stays unused until the release of the group. A young
+   value can be stored into a root of a group with `boxroot_modify`
+   only from the domain of the group.
+
+   `boxroot_group_release(g)` deletes all the boxroots of the group
+   `g` at once, without visiting them, and frees the group. None of
+   its boxroots must be used afterwards. If called without holding
+   the lock of the domain of the group, the release is delayed until
+   the next garbage collection.
+
+   Groups belong to the domain that created them: `boxroot_create_in`
+   fails with `errno == EPERM` when called from another domain. When
+   the domain terminates, its groups can only be released. The OCaml
+   domain lock must be held before calling `boxroot_group_create` and
+   `boxroot_create_in`. */
+typedef struct bxr_group_private* boxroot_group;
+boxroot_group boxroot_group_create();
+inline boxroot boxroot_create_in(boxroot_group, value);
+void boxroot_group_release(boxroot_group);
+
+/* Arrays of roots, for C containers of OCaml values. An array of
+   size `n` stores `n` values contiguously, and is scanned by the GC
+   as one range: it costs one allocation instead of `n` boxroots.
+
+   `boxroot_array_create(n)` allocates a new array of size `n` whose
+   elements are initialised to `Val_unit`. A return value of `NULL`
+   indicates a failure of allocation or initialization of Boxroot
+   (see `boxroot_status`).
+
+   `boxroot_array_get(a, i)` and `boxroot_array_get_ref(a, i)` give
+   access to the element `i` of the array `a` like `boxroot_get` and
+   `boxroot_get_ref`. The pointer becomes invalid after any call to
+   `boxroot_array_resize(&a, n)` or `boxroot_array_delete(a)`.
+
+   `boxroot_array_set(a, i, v)` stores `v` as the element `i` of `a`.
+   Like `boxroot_modify`, a slow path is taken at most once between
+   two minor collections. It returns `false` if the domain lock is
+   not held, or when storing a young value into an array from another
+   domain than the one that created it (`errno == EPERM`).
+
+   `boxroot_array_resize(&a, n)` changes the size of `a` to `n`. New
+   elements are initialised to `Val_unit`. The pointer `a` may
+   change. It returns `false` in case of allocation failure, or when
+   called from another domain than the one that created the array
+   (`errno == EPERM`); `a` is then left unchanged.
+
+   `boxroot_array_delete(a)` deallocates the array `a`. (One does not
+   need to hold the OCaml domain lock before calling it.)
+
+   The OCaml domain lock must be held before calling the other
+   functions, and indices must be less than `boxroot_array_size(a)`. */
+typedef struct bxr_array_private* boxroot_array;
+boxroot_array boxroot_array_create(size_t);
+inline size_t boxroot_array_size(boxroot_array);
+inline value boxroot_array_get(boxroot_array, size_t);
+inline value const * boxroot_array_get_ref(boxroot_array, size_t);
+inline bool boxroot_array_set(boxroot_array, size_t, value);
+bool boxroot_array_resize(boxroot_array *, size_t);
+void boxroot_array_delete(boxroot_array);
+
+/* Intrusive boxroots. A `boxroot_cell` is embedded by the caller
+   inside their own data structure, so that reading its value does
+   not require an indirection.
+
+   `boxroot_cell_register(&c, v)` initialises the cell `c` to the
+   value `v` and registers it with the GC. The cell must not move in
+   memory until it is unregistered. A return value of `false`
+   indicates a failure of allocation or initialization of Boxroot
+   (see `boxroot_status`).
+
+   `boxroot_cell_get(&c)`, `boxroot_cell_get_ref(&c)` and
+   `boxroot_cell_set(&c, v)` are the analogues of `boxroot_get`,
+   `boxroot_get_ref` and `boxroot_modify` for cells. Storing a young
+   value with `boxroot_cell_set` fails with `errno == EPERM` from
+   another domain than the one that registered the cell.
+
+   `boxroot_cell_unregister(&c)` unregisters the cell `c`, after which
+   its memory can be reused.
+
+   The OCaml domain lock must be held before calling any of these
+   functions (including `boxroot_cell_unregister`). */
+typedef struct boxroot_cell boxroot_cell;
+bool boxroot_cell_register(boxroot_cell *, value);
+inline value boxroot_cell_get(boxroot_cell const *);
+inline value const * boxroot_cell_get_ref(boxroot_cell const *);
+inline bool boxroot_cell_set(boxroot_cell *, value);
+void boxroot_cell_unregister(boxroot_cell *);
+
 /* `boxroot_teardown()` releases all the resources of Boxroot. None of
    the function above must be called after this. `boxroot_teardown`
    can only be called after OCaml shuts down. */
@@ -75,9 +317,13 @@ void boxroot_teardown();
              only with OCaml 4). With OCaml 5 there is nothing to do.
 
    - Transient failures (`BOXROOT_RUNNING`), check `errno`:
-       - `errno == EPERM`: you tried calling `boxroot_create` or
-         `boxroot_modify` without holding the domain lock.
-       - `errno == ENOMEM`: allocation failure of the backing store. */
+       - `errno == EPERM`: you tried calling `boxroot_create`,
+         `boxroot_modify` or `boxroot_migrate` without holding the
+         domain lock, or using a group from another domain than its
+         own.
+       - `errno == ENOMEM`: allocation failure of the backing store,
+         or the hard memory limit has been reached (see
+         `boxroot_set_memory_limits`). */
 enum {
   BOXROOT_NOT_SETUP,
   BOXROOT_RUNNING,
@@ -86,12 +332,87 @@ enum {
 };
 int boxroot_status();
 
+/* `boxroot_set_memory_limits(soft, hard, cb)` limits the memory used
+   by the pools of boxroots, in bytes, including the empty pools kept
+   for reuse. A limit of 0 means no limit.
+
+   - When the memory of the pools reaches `soft`, `cb(bytes)` is
+     called with the current memory of the pools, if `cb` is not
+     `NULL`. This happens on the thread allocating the new pool, which
+     holds its domain lock; `cb` must not call Boxroot.
+   - Once the memory of the pools reaches `hard`, allocations needing
+     a new pool fail with `errno == ENOMEM`.
+
+   Arrays and cell registries are not accounted for. The limits can
+   be changed at any time. */
+typedef void (*boxroot_memory_callback)(size_t);
+void boxroot_set_memory_limits(size_t soft, size_t hard,
+                               boxroot_memory_callback cb);
+
+/* Tuning. The following parameters can be set with
+   `boxroot_configure(param, n)`, or with the environment variable of
+   the same name without `PARAM_` (e.g. `BOXROOT_POOL_LOG_SIZE=15`).
+   They are read when Boxroot is initialised, at the first allocation;
+   values set with `boxroot_configure` take precedence over the
+   environment, and invalid values in the environment are ignored.
+
+   - `BOXROOT_PARAM_POOL_LOG_SIZE`: log2 of the size of the pools in
+     bytes, from 12 to 16 (default: 14).
+   - `BOXROOT_PARAM_YOUNG_POOL_LOG_SIZE`: log2 of the size of young
+     pools, at most the previous one (default: the same). New roots
+     are allocated in pools of this size, which are cheaper to scan
+     at minor collection. Pools that survive promotion grow to the
+     full size when they are reused for allocation, as do the pools
+     of permanent roots. E.g. 12 and 16.
+   - `BOXROOT_PARAM_DEALLOC_THRESHOLD`: pools are reconsidered for
+     allocation every that many deallocations; a power of 2 (default:
+     half of the pool size).
+   - `BOXROOT_PARAM_LOW_WATER_PERCENT`: pools become available for
+     allocation again when their roots occupy at most that percentage
+     of their size (default: 50).
+   - `BOXROOT_PARAM_RETAIN_MIN_POOLS`, `BOXROOT_PARAM_RETAIN_MAX_POOLS`:
+     bounds on the number of empty pools kept by each domain at major
+     collection, beyond reserved pools (default: 0 and 1024).
+   - `BOXROOT_PARAM_RETAIN_DECAY`: number of major cycles over which
+     the peak usage of pools is averaged to decide how many empty
+     pools to keep (default: 4).
+
+   A return value of `false` indicates that the parameter or the value
+   is invalid (`errno == EINVAL`), or that Boxroot is already
+   initialised (`errno == EBUSY`). */
+enum {
+  BOXROOT_PARAM_POOL_LOG_SIZE,
+  BOXROOT_PARAM_DEALLOC_THRESHOLD,
+  BOXROOT_PARAM_LOW_WATER_PERCENT,
+  BOXROOT_PARAM_RETAIN_MIN_POOLS,
+  BOXROOT_PARAM_RETAIN_MAX_POOLS,
+  BOXROOT_PARAM_RETAIN_DECAY,
+  BOXROOT_PARAM_YOUNG_POOL_LOG_SIZE,
+  BOXROOT_PARAM_COUNT
+};
+bool boxroot_configure(int param, long n);
+
 /* Show some statistics on the standard output. */
 void boxroot_print_stats();
 
 /* Obsolete, does nothing. */
 bool boxroot_setup();
 
+/* Single-threaded build.
+
+   The library `boxroot_st` (archive `libboxroot_st.a`, or the
+   `single-threaded` feature of the Rust crate) is a build of Boxroot
+   for programs that use Boxroot from a single domain (the first one)
+   and no systhreads. Its fast paths do not check that the domain
+   lock is held and do not handle deallocations from other threads,
+   and it does not collect statistics.
+
+   Clients must define `BOXROOT_SINGLE_THREADED=1` when including
+   this header. The symbols of this build are prefixed with `st_`, so
+   that it cannot be mixed up with the thread-safe build. Using it
+   from another domain fails (`errno == EPERM`); using it from several
+   threads is undefined behaviour. */
+
 
 /* ================================================================= */
 
@@ -112,25 +433,38 @@ typedef struct bxr_free_list {
   /* length of the list */
   int alloc_count;
   int domain_id;
-  /* kept in sync with its location in the pool rings. */
+  /* kept in sync with its location in the pool rings, except for
+     young pools: see below. */
   int class;
 } bxr_free_list;
 
 #define BXR_CLASS_YOUNG 0
 
-extern _Thread_local ptrdiff_t bxr_cached_dom_id;
+extern _Thread_local ptrdiff_t bxr_cached_dom_id BXR_TLS_MODEL;
 extern bxr_free_list *bxr_current_free_list[/*Num_domains + 1*/];
 
+/* The class of the young pools of each domain. Each minor collection
+   gives a new young class to the domain, which makes all its previous
+   young pools old at once. */
+extern int bxr_young_class[/*Num_domains + 1*/];
+
+#define Bxr_is_young_class(cl) ((cl) == bxr_young_class[Bxr_cached_dom_id + 1])
+
 void bxr_create_debug(value v);
 boxroot bxr_create_slow(value v);
 
-/* Used to test the overheads of multithreading (systhreads and
-   multicore) A value of false makes boxroot domain-local (no movement
-   between domains allowed), and single-threaded (no deletion without
-   the domain lock allowed, no check for domain lock ownerhsip).
-   Purely for experimental purposes. Otherwise should always be
-   true. */
-#define BXR_MULTITHREAD true
+/* A value of false makes boxroot domain-local (no movement between
+   domains allowed, only the first domain can use boxroot), and
+   single-threaded (no deletion without the domain lock allowed, no
+   check for domain lock ownerhsip). This is the single-threaded
+   build. */
+#define BXR_MULTITHREAD (!BOXROOT_SINGLE_THREADED)
+
+/* The domain id in the fast paths. It is constant in the
+   single-threaded build. */
+#define Bxr_cached_dom_id \
+  ((OCAML_MULTICORE && BXR_MULTITHREAD) ? bxr_cached_dom_id : 0)
+
 /* Make every deallocation a remote deallocation. For testing purposes
    only. Otherwise should always be false. */
 #define BXR_FORCE_REMOTE false
@@ -141,7 +475,7 @@ inline boxroot boxroot_create(value init)
   bxr_create_debug(init);
 #endif
   /* Find current free_list. Synchronized by domain lock. */
-  ptrdiff_t dom_id = OCAML_MULTICORE ? bxr_cached_dom_id : 0;
+  ptrdiff_t dom_id = Bxr_cached_dom_id;
   bxr_free_list *fl = bxr_current_free_list[dom_id + 1];
   bxr_slot_ref new_root = fl->next;
   if (BXR_UNLIKELY(BXR_MULTITHREAD && !bxr_domain_lock_held())
@@ -153,18 +487,141 @@ inline boxroot boxroot_create(value init)
   return (boxroot)new_root;
 }
 
-/* Log of the size of the pools (12 = 4KB, an OS page).
-   Recommended: 14. */
+struct bxr_group_private {
+  /* The free list of the pool being filled */
+  bxr_free_list *fl;
+};
+
+boxroot bxr_create_in_slow(boxroot_group g, value init);
+
+inline boxroot boxroot_create_in(boxroot_group g, value init)
+{
+#if defined(BOXROOT_DEBUG) && BOXROOT_DEBUG
+  bxr_create_debug(init);
+#endif
+  ptrdiff_t dom_id = Bxr_cached_dom_id;
+  bxr_free_list *fl = g->fl;
+  bxr_slot_ref new_root = fl->next;
+  /* The pool must be scanned during minor collections, and belong to
+     the current domain. */
+  if (BXR_UNLIKELY(BXR_MULTITHREAD && !bxr_domain_lock_held())
+      || BXR_UNLIKELY(new_root == (bxr_slot_ref)fl)
+      || BXR_UNLIKELY(!Bxr_is_young_class(fl->class))
+      || BXR_UNLIKELY(fl->domain_id != dom_id))
+    return bxr_create_in_slow(g, init);
+  fl->next = new_root->as_slot_ref;
+  fl->alloc_count++;
+  new_root->as_value = init;
+  return (boxroot)new_root;
+}
+
+struct bxr_array_private {
+  size_t size;
+  /* kept in sync with its location in the arrays of its domain */
+  int class;
+  /* followed by the elements */
+};
+
+#define Bxr_array_items(a) ((value *)((a) + 1))
+
+inline size_t boxroot_array_size(boxroot_array a) { return a->size; }
+
+inline value boxroot_array_get(boxroot_array a, size_t i)
+{
+  return Bxr_array_items(a)[i];
+}
+
+inline value const * boxroot_array_get_ref(boxroot_array a, size_t i)
+{
+  return &Bxr_array_items(a)[i];
+}
+
+bool bxr_array_set_slow(boxroot_array a, size_t i, value v);
+
+inline bool boxroot_array_set(boxroot_array a, size_t i, value v)
+{
+  if (BXR_UNLIKELY(!bxr_domain_lock_held())) return 0;
+  if (BXR_LIKELY(a->class == BXR_CLASS_YOUNG)) {
+    Bxr_array_items(a)[i] = v;
+    return 1;
+  }
+  return bxr_array_set_slow(a, i, v);
+}
+
+struct boxroot_cell {
+  value bxr_contents;
+  /* The slot of the cell in its registry, tagged with its class */
+  uintptr_t bxr_slot;
+};
+
+#define Bxr_cell_class(c) ((int)((c)->bxr_slot & 1))
+
+inline value boxroot_cell_get(boxroot_cell const *c)
+{
+  return c->bxr_contents;
+}
+
+inline value const * boxroot_cell_get_ref(boxroot_cell const *c)
+{
+  return &c->bxr_contents;
+}
+
+bool bxr_cell_set_slow(boxroot_cell *c, value v);
+
+inline bool boxroot_cell_set(boxroot_cell *c, value v)
+{
+  if (BXR_UNLIKELY(!bxr_domain_lock_held())) return 0;
+  if (BXR_LIKELY(Bxr_cell_class(c) == BXR_CLASS_YOUNG)) {
+    c->bxr_contents = v;
+    return 1;
+  }
+  return bxr_cell_set_slow(c, v);
+}
+
+/* Default log of the size of the pools (12 = 4KB, an OS page), and
+   its bounds (see `BOXROOT_PARAM_POOL_LOG_SIZE`). Recommended: 14. */
 #define BXR_POOL_LOG_SIZE 14
+#define BXR_POOL_MIN_LOG_SIZE 12
+#define BXR_POOL_MAX_LOG_SIZE 16
 #define BXR_POOL_SIZE ((size_t)1 << BXR_POOL_LOG_SIZE)
-/* Every DEALLOC_THRESHOLD deallocations, make a pool available for
-   allocation or demotion into a young pool, or reclassify it as an
-   empty pool if empty. Change this with benchmarks in hand. Must be a
-   power of 2. */
-#define BXR_DEALLOC_THRESHOLD ((int)BXR_POOL_SIZE / 2)
+
+/* Parameters of the fast paths, fixed at initialisation. */
+extern struct bxr_params {
+  /* Mask giving the pool of a slot: ~(pool size - 1) */
+  uintptr_t pool_mask;
+  /* Every dealloc_threshold deallocations, make a pool available for
+     allocation or demotion into a young pool, or reclassify it as an
+     empty pool if empty. A power of 2. */
+  int dealloc_threshold;
+} bxr_params;
 
 #define Bxr_get_pool_header(s)                                      \
-  ((bxr_free_list *)((uintptr_t)(s) & ~((uintptr_t)BXR_POOL_SIZE - 1)))
+  ((bxr_free_list *)((uintptr_t)(s) & bxr_params.pool_mask))
+
+/* A compact boxroot is made of the index of its pool in
+   bxr_pool_table and of the offset of its slot in the pool. Pools are
+   entered in the table when a compact boxroot is first made for one
+   of their slots. The table limits the number of such pools to
+   2^BXR_COMPACT_POOL_BITS - 1. */
+#define BXR_COMPACT_SLOT_BITS \
+  (BXR_POOL_MAX_LOG_SIZE - (sizeof(bxr_slot) == 8 ? 3 : 2))
+#define BXR_COMPACT_POOL_BITS (32 - BXR_COMPACT_SLOT_BITS)
+
+extern bxr_slot **bxr_pool_table; /* [1 << BXR_COMPACT_POOL_BITS] */
+
+#define Bxr_compact_root(h)                                         \
+  ((boxroot)&bxr_pool_table[(h) >> BXR_COMPACT_SLOT_BITS]            \
+   [(h) & (((boxroot_compact)1 << BXR_COMPACT_SLOT_BITS) - 1)])
+
+inline value boxroot_compact_get(boxroot_compact h)
+{
+  return boxroot_get(Bxr_compact_root(h));
+}
+
+inline value const * boxroot_compact_get_ref(boxroot_compact h)
+{
+  return boxroot_get_ref(Bxr_compact_root(h));
+}
 
 inline bool bxr_free_slot(bxr_free_list *fl, boxroot root)
 {
@@ -176,7 +633,7 @@ inline bool bxr_free_slot(bxr_free_list *fl, boxroot root)
     fl->end = s;
   fl->next = s;
   int alloc_count = --fl->alloc_count;
-  return (alloc_count & (BXR_DEALLOC_THRESHOLD - 1)) == 0;
+  return (alloc_count & (bxr_params.dealloc_threshold - 1)) == 0;
 }
 
 void bxr_delete_debug(boxroot root);
@@ -210,7 +667,7 @@ inline bool boxroot_modify(boxroot *rootp, value new_value)
   if (BXR_UNLIKELY(!bxr_domain_lock_held())) return 0;
   bxr_slot_ref s = (bxr_slot_ref)*rootp;
   bxr_free_list *fl = Bxr_get_pool_header(s);
-  if (BXR_LIKELY(fl->class == BXR_CLASS_YOUNG)) {
+  if (BXR_LIKELY(Bxr_is_young_class(fl->class))) {
     s->as_value = new_value;
     return 1;
   } else {
@@ -220,4 +677,35 @@ inline bool boxroot_modify(boxroot *rootp, value new_value)
   }
 }
 
+inline void boxroot_weak_delete(boxroot_weak w)
+{
+  boxroot_delete((boxroot)w);
+}
+
+inline void boxroot_compact_delete(boxroot_compact h)
+{
+  boxroot_delete(Bxr_compact_root(h));
+}
+
+bool bxr_compact_modify_slow(boxroot_compact *h, value v);
+
+inline bool boxroot_compact_modify(boxroot_compact *h, value v)
+{
+  boxroot root = Bxr_compact_root(*h);
+#if defined(BOXROOT_DEBUG) && BOXROOT_DEBUG
+  bxr_modify_debug(&root);
+#endif
+  if (BXR_UNLIKELY(!bxr_domain_lock_held())) return 0;
+  bxr_slot_ref s = (bxr_slot_ref)root;
+  bxr_free_list *fl = Bxr_get_pool_header(s);
+  if (BXR_LIKELY(Bxr_is_young_class(fl->class))) {
+    s->as_value = v;
+    return 1;
+  } else {
+    return bxr_compact_modify_slow(h, v);
+  }
+}
+
+BXR_API_END
+
 #endif // BOXROOT_H
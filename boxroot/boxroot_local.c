@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: MIT */
+#define CAML_NAME_SPACE
+#define CAML_INTERNALS
+
+#include <stdlib.h>
+#include "boxroot_local.h"
+
+/* {{{ Segments */
+
+typedef struct segment {
+  /* ntables = 1, tables[0] = items, nitems = number of used items */
+  struct caml__roots_block block;
+  intnat capacity;
+  value items[];
+} segment;
+
+/* Maximum number of segments kept in the cache of each domain */
+#define MAX_CACHED_SEGMENTS 8
+
+/* Segments released by frames of the domain, linked through
+   [block.next]. Only accessed from one's own domain. Ownership
+   requires the domain lock. */
+typedef struct {
+  segment *first;
+  int length;
+} segment_cache;
+
+/* One cache per domain, sized by the maximum number of domains of
+   the runtime. Allocated on first use, since local roots do not
+   require setup. */
+static _Atomic(segment_cache *) caches = NULL;
+
+/* Return the cache of the current domain, or NULL if the caches
+   could not be allocated, in which case segments are not cached. */
+/* ownership required: domain */
+static segment_cache * domain_cache(void)
+{
+  segment_cache *c = atomic_load_explicit(&caches, memory_order_acquire);
+  if (c == NULL) {
+    segment_cache *fresh = calloc(bxr_runtime_max_domains(),
+                                  sizeof(segment_cache));
+    if (fresh == NULL) return NULL;
+    if (atomic_compare_exchange_strong(&caches, &c, fresh)) c = fresh;
+    else free(fresh);
+  }
+  return &c[Domain_id];
+}
+
+/* Return a segment with capacity at least [capacity]. */
+/* ownership required: domain */
+static segment * get_segment(intnat capacity)
+{
+  segment_cache *cache = domain_cache();
+  if (cache != NULL) {
+    segment **prev = &cache->first;
+    for (segment *seg = *prev; seg != NULL;
+         prev = (segment **)&seg->block.next, seg = *prev) {
+      if (seg->capacity >= capacity) {
+        *prev = (segment *)seg->block.next;
+        cache->length--;
+        return seg;
+      }
+    }
+  }
+  segment *seg = malloc(sizeof(segment) + capacity * sizeof(value));
+  if (seg == NULL) return NULL;
+  seg->capacity = capacity;
+  return seg;
+}
+
+/* ownership required: domain */
+static void release_segment(segment *seg)
+{
+  segment_cache *cache = domain_cache();
+  if (cache == NULL || cache->length >= MAX_CACHED_SEGMENTS) {
+    free(seg);
+    return;
+  }
+  seg->block.next = (struct caml__roots_block *)cache->first;
+  cache->first = seg;
+  cache->length++;
+}
+
+/* ownership required: all domains */
+void boxroot_local_teardown(void)
+{
+  segment_cache *c = atomic_exchange(&caches, NULL);
+  if (c == NULL) return;
+  for (int i = 0; i < bxr_runtime_max_domains(); i++) {
+    segment *seg = c[i].first;
+    while (seg != NULL) {
+      segment *next = (segment *)seg->block.next;
+      free(seg);
+      seg = next;
+    }
+  }
+  free(c);
+}
+
+/* }}} */
+
+/* {{{ Frames */
+
+/* Find the current frame below CAMLparam blocks. */
+/* ownership required: domain */
+static boxroot_local_frame * find_frame(void)
+{
+  struct caml__roots_block *b = Caml_state->local_roots;
+  while (b != NULL && !Bxr_is_local_frame(b)) b = b->next;
+  return (boxroot_local_frame *)b;
+}
+
+/* ownership required: domain */
+void bxr_local_release_segments(boxroot_local_frame *frame)
+{
+  struct caml__roots_block *b = frame->head.next;
+  while (b != &frame->first) {
+    segment *seg = (segment *)b;
+    b = b->next;
+    release_segment(seg);
+  }
+  frame->head.next = &frame->first;
+}
+
+/* }}} */
+
+/* {{{ Local roots */
+
+/* ownership required: domain */
+boxroot_local bxr_local_create_slow(value v)
+{
+  boxroot_local_frame *frame = find_frame();
+  if (frame == NULL) return NULL;
+  value *res = frame->free_list;
+  if (res != NULL) {
+    frame->free_list = (value *)(*res & ~(value)1);
+  } else {
+    struct caml__roots_block *s = frame->current;
+    if (s->nitems == frame->capacity) {
+      /* Insert a new segment just below the head. */
+      segment *seg = get_segment(2 * frame->capacity);
+      if (seg == NULL) return NULL;
+      s = &seg->block;
+      s->next = frame->head.next;
+      s->ntables = 1;
+      s->nitems = 0;
+      s->tables[0] = seg->items;
+      frame->head.next = s;
+      frame->current = s;
+      frame->capacity = seg->capacity;
+    }
+    res = &s->tables[0][s->nitems++];
+  }
+  *res = v;
+  return (boxroot_local)res;
+}
+
+/* ownership required: domain */
+void bxr_local_delete_slow(boxroot_local r)
+{
+  boxroot_local_frame *frame = find_frame();
+  if (frame == NULL) return;
+  value *s = (value *)r;
+  *s = (value)frame->free_list | (value)1;
+  frame->free_list = s;
+}
+
+extern inline void boxroot_local_enter(boxroot_local_frame *frame);
+extern inline void boxroot_local_leave(boxroot_local_frame *frame);
+extern inline boxroot_local boxroot_local_create(value v);
+extern inline void boxroot_local_delete(boxroot_local r);
+extern inline value boxroot_local_get(boxroot_local r);
+extern inline value const * boxroot_local_get_ref(boxroot_local r);
+
+/* }}} */
@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: MIT */
+#ifndef BOXROOT_LOCAL_H
+#define BOXROOT_LOCAL_H
+
+#include <stdbool.h>
+#include <caml/memory.h>
+#include "ocaml_hooks.h"
+#include "platform.h"
+
+BXR_API_BEGIN
+
+/* Scoped local roots.
+
+   A `boxroot_local` is a root whose lifetime is bounded by a frame,
+   in the manner of `CAMLparam`/`CAMLreturn`, but which can be passed
+   around by reference like a boxroot (following a caller-roots
+   convention). It is cheaper than a `boxroot` for short-lived roots:
+   roots are allocated in the frame by bumping a pointer, and are all
+   released at once when leaving the frame. Frames which need more
+   roots than fit inline get additional segments from a per-domain
+   cache, so that repeated calls do not call the allocator.
+
+   Usage:
+
+   ```
+   value my_stub(value v)
+   {
+     boxroot_local_frame frame;
+     boxroot_local_enter(&frame);
+     boxroot_local r = boxroot_local_create(v);
+     […]
+     value res = boxroot_local_get(r);
+     boxroot_local_leave(&frame);
+     return res;
+   }
+   ```
+
+   Local roots can be freely mixed with `CAMLparam`/`CAMLlocal`
+   provided that the blocks are well-parenthesised: a `CAMLparam`
+   inside a frame must be matched by its `CAMLreturn` before leaving
+   the frame. Local roots can be created and deleted at any point
+   between `boxroot_local_enter` and `boxroot_local_leave`, including
+   below a `CAMLparam`. When an exception escapes the frame (e.g. from
+   `caml_callback`), the frame is released by the runtime like
+   `CAMLparam` blocks are, but the additional segments of the frame,
+   if any, are never freed: this leaks memory. Use `caml_callback_exn`
+   and leave the frame before re-raising if this matters.
+
+   The OCaml domain lock must be held before calling any of the
+   functions below, except `boxroot_local_teardown`. */
+
+typedef struct bxr_local_private* boxroot_local;
+typedef struct boxroot_local_frame boxroot_local_frame;
+
+/* `boxroot_local_enter(&frame)` makes `frame` the current frame. The
+   frame must be allocated on the stack of the caller and must be
+   left with `boxroot_local_leave` before returning. */
+inline void boxroot_local_enter(boxroot_local_frame *);
+
+/* `boxroot_local_leave(&frame)` releases all the local roots of
+   `frame`, and makes the previous frame current again. */
+inline void boxroot_local_leave(boxroot_local_frame *);
+
+/* `boxroot_local_create(v)` allocates a new local root initialised
+   to the value `v` in the current frame.
+
+   A return value of `NULL` indicates a failure of allocation or that
+   there is no current frame. */
+inline boxroot_local boxroot_local_create(value);
+
+/* `boxroot_local_delete(r)` deallocates the local root `r` before the
+   end of its frame, making its slot available to subsequent
+   allocations in the current frame. This is optional: local roots
+   are deallocated when leaving their frame. */
+inline void boxroot_local_delete(boxroot_local);
+
+/* `boxroot_local_get(r)` returns the contained value, subject to the
+   usual discipline for non-rooted values. `boxroot_local_get_ref(r)`
+   returns a pointer to a memory cell containing the value kept alive
+   by `r`, that gets updated whenever its block is moved by the OCaml
+   GC. The pointer becomes invalid after `r` is deleted or its frame
+   is left. */
+inline value boxroot_local_get(boxroot_local r) { return *(value *)r; }
+inline value const * boxroot_local_get_ref(boxroot_local r) { return (value *)r; }
+
+/* `boxroot_local_teardown()` frees the segments cached by all the
+   domains. It is independent from `boxroot_teardown`. It must only be
+   called when no domain is using local roots, for instance after
+   OCaml shuts down. Local roots can still be used afterwards, with
+   new caches. */
+void boxroot_local_teardown(void);
+
+
+/* ================================================================= */
+
+
+/* Private implementation. All identifiers starting with bxr_ are private. */
+
+/* Number of local roots allocated inline in the frame. */
+#define BXR_LOCAL_FRAME_SIZE 16
+
+struct boxroot_local_frame {
+  /* Registered in the local roots of the domain. The frames are the
+     only root blocks with no tables (they are not scanned), which
+     lets us find them. Its next block is the segment being filled,
+     followed by the previous segments down to [first]. */
+  struct caml__roots_block head;
+  /* Segment being filled and its capacity */
+  struct caml__roots_block *current;
+  intnat capacity;
+  /* Deleted slots, linked through tagged pointers so that they look
+     like immediates to the GC. */
+  value *free_list;
+  /* The inline segment */
+  struct caml__roots_block first;
+  value items[BXR_LOCAL_FRAME_SIZE];
+};
+
+#define Bxr_is_local_frame(b) ((b)->ntables == 0)
+
+inline void boxroot_local_enter(boxroot_local_frame *frame)
+{
+  frame->first.next = Caml_state->local_roots;
+  frame->first.ntables = 1;
+  frame->first.nitems = 0;
+  frame->first.tables[0] = frame->items;
+  frame->head.next = &frame->first;
+  frame->head.ntables = 0;
+  frame->head.nitems = 0;
+  frame->current = &frame->first;
+  frame->capacity = BXR_LOCAL_FRAME_SIZE;
+  frame->free_list = NULL;
+  Caml_state->local_roots = &frame->head;
+}
+
+void bxr_local_release_segments(boxroot_local_frame *frame);
+
+inline void boxroot_local_leave(boxroot_local_frame *frame)
+{
+  if (BXR_UNLIKELY(frame->head.next != &frame->first))
+    bxr_local_release_segments(frame);
+  Caml_state->local_roots = frame->first.next;
+}
+
+boxroot_local bxr_local_create_slow(value v);
+
+inline boxroot_local boxroot_local_create(value v)
+{
+  /* No test of bxr_domain_lock_held(): in OCaml 4 it is only
+     maintained once Boxroot is set up, which local roots do not
+     need. Like CAMLparam, they require the domain lock. */
+  struct caml__roots_block *b = Caml_state->local_roots;
+  /* Fast path when no CAMLparam sits on top of the current frame. */
+  if (BXR_UNLIKELY(b == NULL || !Bxr_is_local_frame(b)))
+    return bxr_local_create_slow(v);
+  boxroot_local_frame *frame = (boxroot_local_frame *)b;
+  value *res = frame->free_list;
+  if (res != NULL) {
+    frame->free_list = (value *)(*res & ~(value)1);
+  } else {
+    struct caml__roots_block *s = frame->current;
+    if (BXR_UNLIKELY(s->nitems == frame->capacity))
+      return bxr_local_create_slow(v);
+    res = &s->tables[0][s->nitems++];
+  }
+  *res = v;
+  return (boxroot_local)res;
+}
+
+void bxr_local_delete_slow(boxroot_local r);
+
+inline void boxroot_local_delete(boxroot_local r)
+{
+  struct caml__roots_block *b = Caml_state->local_roots;
+  if (BXR_UNLIKELY(b == NULL || !Bxr_is_local_frame(b))) {
+    bxr_local_delete_slow(r);
+    return;
+  }
+  boxroot_local_frame *frame = (boxroot_local_frame *)b;
+  value *s = (value *)r;
+  *s = (value)frame->free_list | (value)1;
+  frame->free_list = s;
+}
+
+BXR_API_END
+
+#endif // BOXROOT_LOCAL_H
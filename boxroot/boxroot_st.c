@@ -0,0 +1,4 @@
+/* SPDX-License-Identifier: MIT */
+/* Single-threaded build, see BOXROOT_SINGLE_THREADED in boxroot.h */
+#define BOXROOT_SINGLE_THREADED 1
+#include "boxroot.c"
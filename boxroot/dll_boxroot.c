@@ -386,7 +386,7 @@ int dll_boxroot_setup()
   rings.young = NULL;
   rings.old = NULL;
   rings.free = NULL;
-  bxr_setup_hooks(&scanning_callback, NULL);
+  bxr_setup_hooks(&scanning_callback, NULL, NULL, NULL);
   // we are done
   setup = 1;
   if (BOXROOT_DEBUG) validate_all_rings();
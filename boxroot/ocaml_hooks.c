@@ -10,11 +10,16 @@
 
 #include <caml/misc.h>
 #include <caml/minor_gc.h>
+#include <caml/major_gc.h>
 #if OCAML_MULTICORE
 #include <caml/domain.h>
+#include <caml/shared_heap.h>
+#else
+#include <caml/address_class.h>
+#include <caml/gc.h>
 #endif
 
-static_assert(Num_domains <= INT_MAX, "num domains <= int max");
+static_assert(Max_num_domains <= INT_MAX, "num domains <= int max");
 static atomic_int in_minor_collection = 0;
 
 static caml_timing_hook prev_minor_begin_hook = NULL;
@@ -50,8 +55,64 @@ bool bxr_in_minor_collection()
   return load_relaxed(&in_minor_collection) != 0;
 }
 
+#if !OCAML_MULTICORE
+/* true during the marking_end callback */
+static bool at_marking_end = false;
+#endif
+
+bool bxr_is_dead(value v)
+{
+#if OCAML_MULTICORE
+  if (Is_young(v)) return false;
+  header_t hd = Hd_val(v);
+  /* Blocks left unmarked by the previous cycle have become garbage
+     when the colours were cycled. Once marking is over, the blocks
+     still unmarked are going to be garbage. */
+  return Has_status_hd(hd, caml_global_heap_state.GARBAGE)
+    || (caml_gc_phase == Phase_sweep_ephe
+        && Has_status_hd(hd, caml_global_heap_state.UNMARKED));
+#else
+  /* During sweeping, white blocks can be fresh allocations or
+     survivors that have been swept already. */
+  return (at_marking_end || caml_gc_phase == Phase_clean)
+    && Is_in_heap(v) && Is_white_val(v);
+#endif
+}
+
+bool bxr_marking_in_progress()
+{
+#if OCAML_MULTICORE
+#if OCAML_VERSION >= 50200
+  if (!caml_marking_started()) return false;
+#endif
+  return caml_gc_phase != Phase_sweep_ephe;
+#else
+  return caml_gc_phase == Phase_mark;
+#endif
+}
+
+void bxr_darken(value v)
+{
+#if OCAML_MULTICORE
+  caml_darken(Caml_state, v, NULL);
+#else
+  caml_darken(v, NULL);
+#endif
+}
+
 static bxr_scanning_callback scanning_callback = NULL;
 
+static caml_timing_hook major_slice_begin_callback = NULL;
+static caml_timing_hook prev_major_slice_begin_hook = NULL;
+
+static void major_slice_begin_hook()
+{
+  if (prev_major_slice_begin_hook != NULL) {
+    (*prev_major_slice_begin_hook)();
+  }
+  (*major_slice_begin_callback)();
+}
+
 #if OCAML_MULTICORE
 
 static scan_roots_hook prev_scan_roots_hook = NULL;
@@ -78,9 +139,12 @@ static void domain_terminated_hook()
 }
 
 void bxr_setup_hooks(bxr_scanning_callback scanning,
-                     caml_timing_hook domain_termination)
+                     caml_timing_hook domain_termination,
+                     caml_timing_hook major_slice_begin,
+                     caml_timing_hook marking_end)
 {
   scanning_callback = scanning;
+  (void)marking_end;
   // Save previous hooks and install ours.
   // prev_*_hook synchronized via domain lock since the hooks are called
   // during STW.
@@ -93,6 +157,11 @@ void bxr_setup_hooks(bxr_scanning_callback scanning,
   domain_terminated_callback = domain_termination;
   prev_domain_terminated_hook = atomic_exchange(&caml_domain_terminated_hook,
                                                 domain_terminated_hook);
+  if (major_slice_begin != NULL) {
+    major_slice_begin_callback = major_slice_begin;
+    prev_major_slice_begin_hook =
+      atomic_exchange(&caml_major_slice_begin_hook, major_slice_begin_hook);
+  }
 }
 
 #else
@@ -108,7 +177,18 @@ static void bxr_scan_hook(scanning_action action)
   (*scanning_callback)(action, only_young, NULL);
 }
 
-_Thread_local bool bxr_thread_has_lock = false;
+static caml_timing_hook marking_end_callback = NULL;
+static void (*prev_major_gc_hook)(void) = NULL;
+
+static void marking_end_hook()
+{
+  if (prev_major_gc_hook != NULL) (*prev_major_gc_hook)();
+  at_marking_end = true;
+  (*marking_end_callback)();
+  at_marking_end = false;
+}
+
+_Thread_local bool bxr_thread_has_lock BXR_TLS_MODEL = false;
 
 static void (*prev_enter_blocking)(void);
 static void (*prev_leave_blocking)(void);
@@ -146,7 +226,9 @@ bool bxr_check_thread_hooks()
 }
 
 void bxr_setup_hooks(bxr_scanning_callback scanning,
-                     caml_timing_hook domain_termination)
+                     caml_timing_hook domain_termination,
+                     caml_timing_hook major_slice_begin,
+                     caml_timing_hook marking_end)
 {
   scanning_callback = scanning;
   // save previous hooks
@@ -157,6 +239,16 @@ void bxr_setup_hooks(bxr_scanning_callback scanning,
   caml_scan_roots_hook = bxr_scan_hook;
   caml_minor_gc_begin_hook = record_minor_begin;
   caml_minor_gc_end_hook = record_minor_end;
+  if (marking_end != NULL) {
+    marking_end_callback = marking_end;
+    prev_major_gc_hook = caml_major_gc_hook;
+    caml_major_gc_hook = marking_end_hook;
+  }
+  if (major_slice_begin != NULL) {
+    major_slice_begin_callback = major_slice_begin;
+    prev_major_slice_begin_hook = caml_major_slice_begin_hook;
+    caml_major_slice_begin_hook = major_slice_begin_hook;
+  }
   setup_thread_hooks();
   (void)domain_termination;
 }
@@ -7,12 +7,20 @@
 
 #if OCAML_MULTICORE
 
+#if BOXROOT_TLS_INITIAL_EXEC && defined(HAS_FULL_THREAD_VARIABLES)
+/* Read the domain state of the runtime with the initial-exec TLS
+   model as well (see BOXROOT_SHARED_LIBRARY). */
+extern __thread caml_domain_state *caml_state BXR_TLS_MODEL;
+#endif
+
 #define bxr_domain_lock_held() (BXR_LIKELY(Caml_state_opt != NULL))
 
 #else
 
 /* true when the master lock is held, false otherwise */
-extern _Thread_local bool bxr_thread_has_lock;
+BXR_API_BEGIN
+extern _Thread_local bool bxr_thread_has_lock BXR_TLS_MODEL;
+BXR_API_END
 
 /* We need a way to detect concurrent mutations of
    [caml_enter/leave_blocking_section_hook]. They are only overwritten
@@ -50,12 +58,33 @@ extern _Thread_local bool bxr_thread_has_lock;
 typedef void (*bxr_scanning_callback) (scanning_action action,
                                        int only_young, void *data);
 
-/* Must be called while holding the domain lock */
+/* Must be called while holding the domain lock. [domain_termination]
+   is only called in OCaml 5. [marking_end] is called at the end of
+   the mark phase of the major GC, before sweeping, and only in
+   OCaml 4. All but [scanning] can be NULL. */
 void bxr_setup_hooks(bxr_scanning_callback scanning,
-                     caml_timing_hook domain_termination);
+                     caml_timing_hook domain_termination,
+                     caml_timing_hook major_slice_begin,
+                     caml_timing_hook marking_end);
 
 bool bxr_in_minor_collection();
 
+/* Whether the block [v] has been found unreachable by the last
+   marking of the major GC. Always false during marking. In OCaml 4,
+   the answer is known from the end of marking until sweeping starts,
+   so the dead blocks must be cleared at the end of marking. In
+   OCaml 5, it remains known until the root scanning at the start of
+   the next cycle. */
+bool bxr_is_dead(value v);
+
+/* Whether the major GC is marking. Must be called while holding the
+   domain lock. */
+bool bxr_marking_in_progress();
+
+/* Mark the block [v] as reachable during marking. Must be called
+   while holding the domain lock. */
+void bxr_darken(value v);
+
 #if !OCAML_MULTICORE
 
 /* Used to regularly check that the hooks have not been overwritten.
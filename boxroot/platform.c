@@ -3,15 +3,45 @@
 
 #include "platform.h"
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #if OCAML_MULTICORE
 
 #include <caml/domain.h>
-static_assert(Max_domains <= Num_domains,
+
+#if defined(Max_domains_max)
+/* The maximum number of domains is chosen at startup (OCAMLRUNPARAM
+   parameter d) */
+#include <caml/startup_aux.h>
+#define Runtime_max_domains ((int)caml_params->max_domains)
+#define Configured_max_domains Max_domains_max
+#else
+#define Runtime_max_domains Max_domains
+#define Configured_max_domains Max_domains
+#endif
+
+static_assert(Configured_max_domains <= Max_num_domains,
               "OCaml is configured for a maximum number of domains greater than"
               " Boxroot's.");
 
+int bxr_num_domains = 0;
+
+/* ownership required: none */
+int bxr_runtime_max_domains(void)
+{
+  return Runtime_max_domains;
+}
+
+#else
+
+int bxr_runtime_max_domains(void)
+{
+  return 1;
+}
+
 #endif
 
 pool * bxr_alloc_uninitialised_pool(size_t size)
@@ -31,6 +61,20 @@ void bxr_free_pool(pool *p) {
     free(p);
 }
 
+/* Return the pages lying entirely within [p, p + size) to the OS,
+   keeping them mapped. Their contents are lost. */
+void bxr_decommit(void *p, size_t size)
+{
+#ifdef MADV_DONTNEED
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t start = ((uintptr_t)p + page - 1) & ~(page - 1);
+  uintptr_t end = ((uintptr_t)p + size) & ~(page - 1);
+  if (start < end) madvise((void *)start, end - start, MADV_DONTNEED);
+#else
+  (void)p; (void)size;
+#endif
+}
+
 bool bxr_initialize_mutex(pthread_mutex_t *mutex)
 {
   return 0 == pthread_mutex_init(mutex, NULL);
@@ -10,12 +10,139 @@
 
 typedef intnat value;
 
+/* Single-threaded build, see boxroot.h. Clients of the library
+   `boxroot_st` must define it as well. */
+#ifndef BOXROOT_SINGLE_THREADED
+#define BOXROOT_SINGLE_THREADED 0
+#endif
+
+#if BOXROOT_SINGLE_THREADED
+/* The single-threaded build has its own symbol names, so that it
+   cannot be linked in place of the thread-safe build, or mixed with
+   it. */
+#define boxroot_array_create st_boxroot_array_create
+#define boxroot_array_delete st_boxroot_array_delete
+#define boxroot_array_get st_boxroot_array_get
+#define boxroot_array_get_ref st_boxroot_array_get_ref
+#define boxroot_array_resize st_boxroot_array_resize
+#define boxroot_array_set st_boxroot_array_set
+#define boxroot_array_size st_boxroot_array_size
+#define boxroot_cell_get st_boxroot_cell_get
+#define boxroot_cell_get_ref st_boxroot_cell_get_ref
+#define boxroot_cell_register st_boxroot_cell_register
+#define boxroot_cell_set st_boxroot_cell_set
+#define boxroot_cell_unregister st_boxroot_cell_unregister
+#define boxroot_compact_create st_boxroot_compact_create
+#define boxroot_compact_delete st_boxroot_compact_delete
+#define boxroot_compact_get st_boxroot_compact_get
+#define boxroot_compact_get_ref st_boxroot_compact_get_ref
+#define boxroot_compact_modify st_boxroot_compact_modify
+#define boxroot_configure st_boxroot_configure
+#define boxroot_create st_boxroot_create
+#define boxroot_create_many st_boxroot_create_many
+#define boxroot_create_in st_boxroot_create_in
+#define boxroot_create_permanent st_boxroot_create_permanent
+#define boxroot_custom_alloc st_boxroot_custom_alloc
+#define boxroot_custom_ops st_boxroot_custom_ops
+#define boxroot_custom_root st_boxroot_custom_root
+#define boxroot_delete st_boxroot_delete
+#define boxroot_delete_many st_boxroot_delete_many
+#define boxroot_get st_boxroot_get
+#define boxroot_get_ref st_boxroot_get_ref
+#define boxroot_group_create st_boxroot_group_create
+#define boxroot_group_release st_boxroot_group_release
+#define boxroot_migrate st_boxroot_migrate
+#define boxroot_modify st_boxroot_modify
+#define boxroot_permanent_get st_boxroot_permanent_get
+#define boxroot_print_stats st_boxroot_print_stats
+#define boxroot_reserve st_boxroot_reserve
+#define boxroot_set_memory_limits st_boxroot_set_memory_limits
+#define boxroot_setup st_boxroot_setup
+#define boxroot_status st_boxroot_status
+#define boxroot_teardown st_boxroot_teardown
+#define boxroot_weak_create st_boxroot_weak_create
+#define boxroot_weak_delete st_boxroot_weak_delete
+#define boxroot_weak_get st_boxroot_weak_get
+#define bxr_alloc_uninitialised_pool st_bxr_alloc_uninitialised_pool
+#define bxr_array_set_slow st_bxr_array_set_slow
+#define bxr_cached_dom_id st_bxr_cached_dom_id
+#define bxr_cell_set_slow st_bxr_cell_set_slow
+#define bxr_check_thread_hooks st_bxr_check_thread_hooks
+#define bxr_compact_modify_slow st_bxr_compact_modify_slow
+#define bxr_create_debug st_bxr_create_debug
+#define bxr_create_in_slow st_bxr_create_in_slow
+#define bxr_create_slow st_bxr_create_slow
+#define bxr_current_free_list st_bxr_current_free_list
+#define bxr_darken st_bxr_darken
+#define bxr_decommit st_bxr_decommit
+#define bxr_delete_debug st_bxr_delete_debug
+#define bxr_delete_slow st_bxr_delete_slow
+#define bxr_free_pool st_bxr_free_pool
+#define bxr_free_slot st_bxr_free_slot
+#define bxr_in_minor_collection st_bxr_in_minor_collection
+#define bxr_initialize_mutex st_bxr_initialize_mutex
+#define bxr_is_dead st_bxr_is_dead
+#define bxr_marking_in_progress st_bxr_marking_in_progress
+#define bxr_modify_debug st_bxr_modify_debug
+#define bxr_modify_slow st_bxr_modify_slow
+#define bxr_mutex_lock st_bxr_mutex_lock
+#define bxr_mutex_unlock st_bxr_mutex_unlock
+#define bxr_num_domains st_bxr_num_domains
+#define bxr_params st_bxr_params
+#define bxr_pool_table st_bxr_pool_table
+#define bxr_runtime_max_domains st_bxr_runtime_max_domains
+#define bxr_setup_hooks st_bxr_setup_hooks
+#define bxr_thread_has_lock st_bxr_thread_has_lock
+#define bxr_young_class st_bxr_young_class
+#endif
+
 #if defined(__GNUC__)
 #define BXR_LIKELY(a) __builtin_expect(!!(a),1)
 #define BXR_UNLIKELY(a) __builtin_expect(!!(a),0)
+#define BXR_PREFETCH_WRITE(p) __builtin_prefetch((p), 1)
 #else
 #define BXR_LIKELY(a) (a)
 #define BXR_UNLIKELY(a) (a)
+#define BXR_PREFETCH_WRITE(p) ((void)(p))
+#endif
+
+/* Shared-library build. Boxroot can be compiled into a shared object
+   (libboxroot.so, or a plugin which links the static archive) with
+   -fPIC -fvisibility=hidden -fno-semantic-interposition
+   -DBOXROOT_SHARED_LIBRARY=1, and its clients should define
+   BOXROOT_SHARED_LIBRARY=1 as well (see `make run-fast_path`).
+
+   - Only the declarations between BXR_API_BEGIN and BXR_API_END are
+     exported: the public API, and the private symbols used by the
+     inline functions of the headers. The other internal symbols are
+     hidden, and calls inside the library do not go through the PLT.
+   - The thread-local variables use the initial-exec TLS model, so
+     that the fast paths read them without calling __tls_get_addr.
+     This is always possible for shared objects loaded at program
+     startup, and for those loaded with dlopen it relies on the
+     surplus of static TLS reserved by the C library, which is enough
+     for the few bytes used by Boxroot. It can be disabled with
+     BOXROOT_TLS_INITIAL_EXEC=0. */
+#ifndef BOXROOT_SHARED_LIBRARY
+#define BOXROOT_SHARED_LIBRARY 0
+#endif
+
+#ifndef BOXROOT_TLS_INITIAL_EXEC
+#define BOXROOT_TLS_INITIAL_EXEC BOXROOT_SHARED_LIBRARY
+#endif
+
+#if defined(__GNUC__)
+#define BXR_API_BEGIN _Pragma("GCC visibility push(default)")
+#define BXR_API_END _Pragma("GCC visibility pop")
+#else
+#define BXR_API_BEGIN
+#define BXR_API_END
+#endif
+
+#if defined(__GNUC__) && BOXROOT_TLS_INITIAL_EXEC
+#define BXR_TLS_MODEL __attribute__((tls_model("initial-exec")))
+#else
+#define BXR_TLS_MODEL
 #endif
 
 #if OCAML_VERSION >= 50000
@@ -30,6 +157,7 @@ typedef intnat value;
 
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stddef.h>
 #include <caml/mlvalues.h>
@@ -38,13 +166,20 @@ typedef intnat value;
 
 #if OCAML_MULTICORE
 
-/* We currently rely on OCaml 5.0 having a max number of domains; this
-   is checked for consistency. */
-#define Num_domains 128
+/* Upper bound on the maximum number of domains of the runtime; this
+   is checked for consistency. It sizes the tables read by the fast
+   paths, whose pages are only touched for the domains in use. */
+#define Max_num_domains 4096
+/* The maximum number of domains of the runtime, which sizes the other
+   per-domain tables. Set by the boxroot setup, see
+   bxr_runtime_max_domains. */
+extern int bxr_num_domains;
+#define Num_domains bxr_num_domains
 #define Domain_id (Caml_state->id)
 
 #else
 
+#define Max_num_domains 1
 #define Num_domains 1
 #define Domain_id 0
 
@@ -60,6 +195,15 @@ typedef intnat value;
 #define decr(a) (atomic_fetch_add_explicit((a), -1, memory_order_relaxed))
 #define decr_release(a) (atomic_fetch_add_explicit((a), -1, memory_order_release))
 
+/* Hint to the processor inside spin-wait loops */
+#if defined(__x86_64__) || defined(__i386__)
+#define bxr_cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define bxr_cpu_relax() __asm__ volatile ("yield" ::: "memory")
+#else
+#define bxr_cpu_relax() ((void)0)
+#endif
+
 typedef pthread_mutex_t mutex_t;
 #define BXR_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER;
 
@@ -88,6 +232,8 @@ typedef struct pool pool;
 
 pool* bxr_alloc_uninitialised_pool(size_t size);
 void bxr_free_pool(pool *p);
+void bxr_decommit(void *p, size_t size);
+int bxr_runtime_max_domains(void);
 
 #endif // CAML_INTERNALS
 
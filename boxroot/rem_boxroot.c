@@ -779,7 +779,7 @@ int rem_boxroot_setup()
   stats = empty_stats;
   pools = NULL;
   full_pools = NULL;
-  bxr_setup_hooks(&scanning_callback, NULL);
+  bxr_setup_hooks(&scanning_callback, NULL, NULL, NULL);
   // we are done
   setup = 1;
   CRITICAL_SECTION_END();
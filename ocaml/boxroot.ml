@@ -0,0 +1,64 @@
+(* SPDX-License-Identifier: MIT *)
+
+(* A boxroot pointer with its lowest bit set (see boxroot_stubs.c).
+   0 stands for NULL. *)
+type 'a t = int
+
+external create_unsafe : 'a -> 'a t = "boxroot_ml_create" [@@noalloc]
+external get : 'a t -> 'a = "boxroot_ml_get" [@@noalloc]
+external modify_unsafe : 'a t -> 'a -> 'a t = "boxroot_ml_modify" [@@noalloc]
+external delete : 'a t -> unit = "boxroot_ml_delete" [@@noalloc]
+
+let null : 'a t = 0
+
+let[@inline] create v =
+  let r = create_unsafe v in
+  if r == null then raise Out_of_memory;
+  r
+
+let[@inline] modify r v =
+  let r' = modify_unsafe r v in
+  if r' == null then raise Out_of_memory;
+  r'
+
+external create_many_unsafe : 'a array -> 'a t array -> bool
+  = "boxroot_ml_create_many" [@@noalloc]
+external delete_many : 'a t array -> unit = "boxroot_ml_delete_many" [@@noalloc]
+
+let create_many (vs : 'a array) =
+  let rs = Array.make (Array.length vs) null in
+  (* Float arrays are unboxed; their elements need not be rooted but
+     would have to be boxed. *)
+  if Obj.tag (Obj.repr vs) = Obj.double_array_tag then
+    for i = 0 to Array.length vs - 1 do
+      let r = create_unsafe vs.(i) in
+      if r == null then begin
+        (* Do not leave any root allocated *)
+        for j = 0 to i - 1 do delete rs.(j) done;
+        raise Out_of_memory
+      end;
+      rs.(i) <- r
+    done
+  else if not (create_many_unsafe vs rs) then raise Out_of_memory;
+  rs
+
+external reserve_unsafe : (int [@untagged]) -> bool
+  = "boxroot_ml_reserve_byte" "boxroot_ml_reserve" [@@noalloc]
+
+let reserve n =
+  if n < 0 then invalid_arg "Boxroot.reserve";
+  if not (reserve_unsafe n) then raise Out_of_memory
+
+type status = Not_setup | Running | Tore_down | Invalid
+
+external status_code : unit -> (int [@untagged])
+  = "boxroot_ml_status_byte" "boxroot_ml_status" [@@noalloc]
+
+let status () =
+  match status_code () with
+  | 0 -> Not_setup
+  | 1 -> Running
+  | 2 -> Tore_down
+  | _ -> Invalid
+
+external print_stats : unit -> unit = "boxroot_ml_print_stats" [@@noalloc]
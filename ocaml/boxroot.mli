@@ -0,0 +1,68 @@
+(* SPDX-License-Identifier: MIT *)
+
+(** Boxroots from OCaml.
+
+    This library exposes the interface of [boxroot/boxroot.h] to
+    OCaml, for programs which allocate roots from OCaml and hand them
+    over to C or Rust code. All the functions are [[@@noalloc]]
+    externals, and roots are immediate values, so that using them
+    costs little more than the C functions.
+
+    A root is the [boxroot] pointer with its lowest bit set. C code
+    receiving a root from OCaml recovers the [boxroot] by clearing
+    this bit, and can then use it with the functions of [boxroot.h];
+    it takes over the ownership of the root if it deletes it.
+
+    The roots follow an ownership discipline: each root must be
+    deleted exactly once, and must not be used after it has been
+    deleted or modified. *)
+
+type 'a t [@@immediate]
+
+val create : 'a -> 'a t
+(** [create v] allocates a new root initialised to [v].
+    @raise Out_of_memory on allocation failure (see {!status}). *)
+
+external get : 'a t -> 'a = "boxroot_ml_get" [@@noalloc]
+(** [get r] returns the value kept alive by [r]. *)
+
+val modify : 'a t -> 'a -> 'a t
+(** [modify r v] changes the value kept alive by [r] to [v], and
+    returns the new root, which replaces [r]. It avoids reallocating
+    the root if possible.
+    @raise Out_of_memory on allocation failure, in which case [r]
+    is left unchanged. *)
+
+external delete : 'a t -> unit = "boxroot_ml_delete" [@@noalloc]
+(** [delete r] deallocates [r]. *)
+
+(** {2 Batch operations} *)
+
+val create_many : 'a array -> 'a t array
+(** [create_many vs] allocates a root for each element of [vs].
+    @raise Out_of_memory on allocation failure, in which case no root
+    is left allocated. *)
+
+external delete_many : 'a t array -> unit = "boxroot_ml_delete_many" [@@noalloc]
+(** [delete_many rs] deallocates all the roots of [rs]. *)
+
+val reserve : int -> unit
+(** [reserve n] allocates in advance enough memory for the current
+    domain to create [n] roots without allocating memory (see
+    [boxroot_reserve]).
+    @raise Out_of_memory on allocation failure.
+    @raise Invalid_argument if [n] is negative. *)
+
+(** {2 Status and statistics} *)
+
+type status = Not_setup | Running | Tore_down | Invalid
+
+val status : unit -> status
+(** The cause of an allocation failure (see [boxroot_status]). *)
+
+external print_stats : unit -> unit = "boxroot_ml_print_stats" [@@noalloc]
+(** Show some statistics on the standard output.
+
+    [boxroot_teardown] is deliberately not exposed: it releases the
+    roots that OCaml values may still hold. Only the C code that owns
+    the program can know that no root is live anymore. *)
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: MIT */
+#define CAML_NAME_SPACE
+#include <caml/mlvalues.h>
+#include "../boxroot/boxroot.h"
+
+/* A boxroot is given to OCaml as an immediate by setting its lowest
+   bit (slots are word-aligned). NULL is seen as 0 from OCaml. All the
+   stubs below are [@@noalloc]. */
+#define Val_boxroot(r) ((value)(r) | (value)1)
+#define Boxroot_val(v) ((boxroot)((v) & ~(value)1))
+
+value boxroot_ml_create(value v)
+{
+  return Val_boxroot(boxroot_create(v));
+}
+
+value boxroot_ml_get(value r)
+{
+  return boxroot_get(Boxroot_val(r));
+}
+
+value boxroot_ml_modify(value r, value v)
+{
+  boxroot b = Boxroot_val(r);
+  if (BXR_UNLIKELY(!boxroot_modify(&b, v))) return Val_boxroot(NULL);
+  return Val_boxroot(b);
+}
+
+value boxroot_ml_delete(value r)
+{
+  boxroot_delete(Boxroot_val(r));
+  return Val_unit;
+}
+
+/* With the domain lock held, boxroot_delete_many amounts to calling
+   boxroot_delete on each root, which we do directly to avoid copying
+   the array. */
+static void delete_prefix(value rs, mlsize_t n)
+{
+  for (mlsize_t i = 0; i < n; i++)
+    boxroot_delete(Boxroot_val(Field(rs, i)));
+}
+
+value boxroot_ml_create_many(value vs, value rs)
+{
+  mlsize_t n = Wosize_val(vs);
+  for (mlsize_t i = 0; i < n; i++) {
+    boxroot r = boxroot_create(Field(vs, i));
+    if (BXR_UNLIKELY(r == NULL)) {
+      delete_prefix(rs, i);
+      return Val_false;
+    }
+    /* Replacing an immediate with an immediate */
+    *(volatile value *)&Field(rs, i) = Val_boxroot(r);
+  }
+  return Val_true;
+}
+
+value boxroot_ml_delete_many(value rs)
+{
+  delete_prefix(rs, Wosize_val(rs));
+  return Val_unit;
+}
+
+value boxroot_ml_reserve(intnat n)
+{
+  return Val_bool(boxroot_reserve((size_t)n));
+}
+
+value boxroot_ml_reserve_byte(value n)
+{
+  return boxroot_ml_reserve(Long_val(n));
+}
+
+intnat boxroot_ml_status(value unit)
+{
+  return boxroot_status();
+}
+
+value boxroot_ml_status_byte(value unit)
+{
+  return Val_long(boxroot_ml_status(unit));
+}
+
+value boxroot_ml_print_stats(value unit)
+{
+  boxroot_print_stats();
+  return unit;
+}
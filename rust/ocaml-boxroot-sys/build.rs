@@ -1,7 +1,7 @@
 /* SPDX-License-Identifier: MIT */
 
 #[cfg(feature = "bundle-boxroot")]
-fn build_boxroot() {
+fn build_boxroot(ocaml5: Option<bool>) {
     println!("cargo:rerun-if-changed=vendor/boxroot/");
     println!("cargo:rerun-if-env-changed=OCAMLOPT");
     println!("cargo:rerun-if-env-changed=OCAML_WHERE_PATH");
@@ -35,6 +35,13 @@ fn build_boxroot() {
     config.file("vendor/boxroot/boxroot.c");
     config.file("vendor/boxroot/ocaml_hooks.c");
     config.file("vendor/boxroot/platform.c");
+    // Checks the layout mirrored in src/fast_path.rs at compile time
+    config.file("src/layout.c");
+    if let Some(ocaml5) = ocaml5 {
+        config.define("OCAML_BOXROOT_SYS_OCAML5", if ocaml5 { "1" } else { "0" });
+    }
+    #[cfg(feature = "single-threaded")]
+    config.define("BOXROOT_SINGLE_THREADED", "1");
 
     config.compile("libocaml-boxroot.a");
 
@@ -98,7 +105,59 @@ fn link_runtime(
     Ok(())
 }
 
+// The inline fast paths need a nightly compiler for
+// `#[thread_local]`. Anything else is rejected in src/lib.rs.
+#[cfg(feature = "inline-fast-paths")]
+fn detect_nightly() {
+    println!("cargo:rustc-check-cfg=cfg(nightly)");
+
+    let rustc = std::env::var("RUSTC").unwrap_or_else(|_| "rustc".to_string());
+    let version = String::from_utf8(
+        std::process::Command::new(&rustc)
+            .arg("--version")
+            .output()
+            .unwrap()
+            .stdout,
+    )
+    .unwrap();
+    if version.contains("-nightly") || version.contains("-dev") {
+        println!("cargo:rustc-cfg=nightly");
+    }
+}
+
+// The inline fast paths depend on the OCaml version (see
+// src/fast_path.rs).
+#[cfg(feature = "inline-fast-paths")]
+fn detect_ocaml_version() -> bool {
+    println!("cargo:rerun-if-env-changed=OCAMLOPT");
+    println!("cargo:rustc-check-cfg=cfg(ocaml5)");
+
+    let ocamlopt = std::env::var("OCAMLOPT").unwrap_or_else(|_| "ocamlopt".to_string());
+    let version = String::from_utf8(
+        std::process::Command::new(&ocamlopt)
+            .arg("-version")
+            .output()
+            .unwrap()
+            .stdout,
+    )
+    .unwrap();
+    let major: u32 = version.trim().split('.').next().unwrap().parse().unwrap();
+    if major >= 5 {
+        println!("cargo:rustc-cfg=ocaml5");
+    }
+    major >= 5
+}
+
 fn main() {
+    #[cfg(feature = "inline-fast-paths")]
+    let ocaml5 = {
+        detect_nightly();
+        Some(detect_ocaml_version())
+    };
+    #[cfg(not(feature = "inline-fast-paths"))]
+    let ocaml5: Option<bool> = None;
     #[cfg(feature = "bundle-boxroot")]
-    build_boxroot();
+    build_boxroot(ocaml5);
+    #[cfg(not(feature = "bundle-boxroot"))]
+    let _ = ocaml5;
 }
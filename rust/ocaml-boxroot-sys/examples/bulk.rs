@@ -0,0 +1,104 @@
+/* SPDX-License-Identifier: MIT */
+
+// Cost per root of creating and deleting boxroots one at a time and
+// in bulk, with and without the domain lock.
+//
+// Run with:
+// cargo run --release --example bulk --features "link-ocaml-runtime-and-dummy-program"
+
+use ocaml_boxroot_sys::{
+    boxroot_create, boxroot_create_slice, boxroot_delete, boxroot_delete_slice, boxroot_teardown,
+    BoxRoot, Value,
+};
+use std::time::Instant;
+
+extern "C" {
+    pub fn caml_startup(argv: *const *const i8);
+    pub fn caml_shutdown();
+}
+
+const N: usize = 100_000;
+const ROUNDS: usize = 50;
+
+fn create_one_by_one(vs: &[Value]) -> Vec<BoxRoot> {
+    vs.iter().map(|&v| unsafe { boxroot_create(v) }.unwrap()).collect()
+}
+
+fn create_bulk(vs: &[Value]) -> Vec<BoxRoot> {
+    let mut rs = Vec::with_capacity(vs.len());
+    unsafe {
+        assert!(boxroot_create_slice(vs, &mut rs.spare_capacity_mut()[..vs.len()]));
+        rs.set_len(vs.len());
+    }
+    rs
+}
+
+fn delete_one_by_one(rs: Vec<BoxRoot>) {
+    for r in rs {
+        unsafe { boxroot_delete(r) }
+    }
+}
+
+fn delete_bulk(rs: Vec<BoxRoot>) {
+    unsafe { boxroot_delete_slice(&rs) }
+}
+
+// BoxRoot is not Send, but boxroots can be deleted from any thread.
+struct SendRoots(Vec<BoxRoot>);
+unsafe impl Send for SendRoots {}
+
+impl SendRoots {
+    fn into_inner(self) -> Vec<BoxRoot> {
+        self.0
+    }
+}
+
+// Delete from a thread that does not hold the domain lock, as when
+// a collection is dropped outside of OCaml.
+fn in_foreign_thread(delete: fn(Vec<BoxRoot>)) -> impl Fn(Vec<BoxRoot>) {
+    move |rs: Vec<BoxRoot>| {
+        let rs = SendRoots(rs);
+        std::thread::spawn(move || delete(rs.into_inner()))
+            .join()
+            .unwrap()
+    }
+}
+
+fn bench(name: &str, create: fn(&[Value]) -> Vec<BoxRoot>, delete: impl Fn(Vec<BoxRoot>)) {
+    /* Immediate values */
+    let vs: Vec<Value> = (0..N as isize).map(|i| (i << 1) | 1).collect();
+    let (mut t_create, mut t_delete) = (0.0, 0.0);
+    for _ in 0..ROUNDS {
+        let t = Instant::now();
+        let rs = create(&vs);
+        t_create += t.elapsed().as_secs_f64();
+        let t = Instant::now();
+        delete(rs);
+        t_delete += t.elapsed().as_secs_f64();
+    }
+    let per_root = |t: f64| t * 1e9 / (N * ROUNDS) as f64;
+    println!(
+        "{:<28} create: {:6.2} ns/root   delete: {:6.2} ns/root",
+        name,
+        per_root(t_create),
+        per_root(t_delete)
+    );
+}
+
+fn main() {
+    unsafe {
+        let arg0 = "ocaml\0".as_ptr() as *const i8;
+        let c_args = vec![arg0, core::ptr::null()];
+        caml_startup(c_args.as_ptr());
+    }
+
+    bench("one by one", create_one_by_one, delete_one_by_one);
+    bench("bulk", create_bulk, delete_bulk);
+    bench("one by one, foreign thread", create_one_by_one, in_foreign_thread(delete_one_by_one));
+    bench("bulk, foreign thread", create_bulk, in_foreign_thread(delete_bulk));
+
+    unsafe {
+        boxroot_teardown();
+        caml_shutdown();
+    }
+}
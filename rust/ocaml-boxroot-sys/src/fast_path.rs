@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: MIT */
+
+// Rust version of the inline fast paths of boxroot/boxroot.h for
+// `boxroot_create`, `boxroot_delete` and `boxroot_modify`, so that
+// they are inlined in Rust code as they are in C. They read the
+// private definitions of the header, whose layout is checked against
+// the C compiler by the test below (see src/layout.c).
+
+use crate::{BoxRoot, Value, ValueCell};
+use core::ffi::c_int;
+use core::ptr::NonNull;
+
+#[repr(C)]
+#[derive(Copy, Clone)]
+union Slot {
+    as_slot_ref: *mut Slot,
+    as_value: Value,
+}
+
+#[repr(C)]
+struct FreeList {
+    next: *mut Slot,
+    /* if non-empty, points to last cell */
+    end: *mut Slot,
+    /* length of the list */
+    alloc_count: c_int,
+    domain_id: c_int,
+    class: c_int,
+}
+
+#[repr(C)]
+struct Params {
+    pool_mask: usize,
+    dealloc_threshold: c_int,
+}
+
+const MULTITHREAD: bool = cfg!(not(feature = "single-threaded"));
+
+extern "C" {
+    #[thread_local]
+    #[cfg_attr(feature = "single-threaded", link_name = "st_bxr_cached_dom_id")]
+    static bxr_cached_dom_id: isize;
+    #[cfg_attr(feature = "single-threaded", link_name = "st_bxr_current_free_list")]
+    static mut bxr_current_free_list: [*mut FreeList; 0];
+    #[cfg_attr(feature = "single-threaded", link_name = "st_bxr_young_class")]
+    static bxr_young_class: [c_int; 0];
+    #[cfg_attr(feature = "single-threaded", link_name = "st_bxr_params")]
+    static bxr_params: Params;
+
+    #[cfg(ocaml5)]
+    #[thread_local]
+    static caml_state: *mut core::ffi::c_void;
+    #[cfg(not(ocaml5))]
+    #[thread_local]
+    #[cfg_attr(feature = "single-threaded", link_name = "st_bxr_thread_has_lock")]
+    static bxr_thread_has_lock: bool;
+
+    #[cfg_attr(feature = "single-threaded", link_name = "st_bxr_create_slow")]
+    fn bxr_create_slow(v: Value) -> Option<BoxRoot>;
+    #[cfg_attr(feature = "single-threaded", link_name = "st_bxr_delete_slow")]
+    fn bxr_delete_slow(fl: *mut FreeList, root: BoxRoot, remote: bool);
+    #[cfg_attr(feature = "single-threaded", link_name = "st_bxr_modify_slow")]
+    fn bxr_modify_slow(root: *mut BoxRoot, v: Value) -> bool;
+}
+
+#[inline(always)]
+unsafe fn domain_lock_held() -> bool {
+    #[cfg(ocaml5)]
+    { !caml_state.is_null() }
+    #[cfg(not(ocaml5))]
+    { bxr_thread_has_lock }
+}
+
+/* See Bxr_cached_dom_id */
+#[inline(always)]
+unsafe fn cached_dom_id() -> isize {
+    if cfg!(ocaml5) && MULTITHREAD { bxr_cached_dom_id } else { 0 }
+}
+
+#[inline(always)]
+unsafe fn pool_header(s: *mut Slot) -> *mut FreeList {
+    (s as usize & bxr_params.pool_mask) as *mut FreeList
+}
+
+#[inline]
+pub unsafe fn boxroot_create(v: Value) -> Option<BoxRoot> {
+    /* Find current free_list. Synchronized by domain lock. */
+    let dom_id = cached_dom_id();
+    let table = core::ptr::addr_of!(bxr_current_free_list) as *const *mut FreeList;
+    let fl = *table.offset(dom_id + 1);
+    let new_root = (*fl).next;
+    if (MULTITHREAD && !domain_lock_held()) || new_root == fl as *mut Slot {
+        return bxr_create_slow(v);
+    }
+    (*fl).next = (*new_root).as_slot_ref;
+    (*fl).alloc_count += 1;
+    (*new_root).as_value = v;
+    Some(BoxRoot { contents: NonNull::new_unchecked(new_root as *mut ValueCell) })
+}
+
+#[inline(always)]
+unsafe fn free_slot(fl: *mut FreeList, s: *mut Slot) -> bool {
+    /* We have the lock of the domain that owns the pool. */
+    let next = (*fl).next;
+    (*s).as_slot_ref = next;
+    if MULTITHREAD && next == fl as *mut Slot {
+        (*fl).end = s;
+    }
+    (*fl).next = s;
+    (*fl).alloc_count -= 1;
+    ((*fl).alloc_count & (bxr_params.dealloc_threshold - 1)) == 0
+}
+
+#[inline]
+pub unsafe fn boxroot_delete(br: BoxRoot) {
+    let s = br.contents.as_ptr() as *mut Slot;
+    let fl = pool_header(s);
+    let remote = MULTITHREAD
+        && ((cfg!(ocaml5) && (*fl).domain_id as isize != cached_dom_id())
+            || !domain_lock_held());
+    if remote || free_slot(fl, s) {
+        /* remote deallocation or deallocation threshold */
+        bxr_delete_slow(fl, br, remote);
+    }
+}
+
+#[inline]
+pub unsafe fn boxroot_modify(br: *mut BoxRoot, v: Value) -> bool {
+    if !domain_lock_held() {
+        return false;
+    }
+    let s = (*br).contents.as_ptr() as *mut Slot;
+    let fl = pool_header(s);
+    let young_class = core::ptr::addr_of!(bxr_young_class) as *const c_int;
+    if (*fl).class == *young_class.offset(cached_dom_id() + 1) {
+        (*s).as_value = v;
+        true
+    } else {
+        /* We might need to reallocate, but this reallocation happens at
+           most once between two minor collections. */
+        bxr_modify_slow(br, v)
+    }
+}
+
+#[cfg(all(test, feature = "bundle-boxroot"))]
+mod tests {
+    use super::{FreeList, Params, Slot, MULTITHREAD};
+    use core::mem::{offset_of, size_of};
+
+    extern "C" {
+        static ocaml_boxroot_sys_layout: [usize; 12];
+    }
+
+    #[test]
+    fn layout() {
+        let c = unsafe { ocaml_boxroot_sys_layout };
+        let rust = [
+            size_of::<Slot>(),
+            size_of::<FreeList>(),
+            offset_of!(FreeList, next),
+            offset_of!(FreeList, end),
+            offset_of!(FreeList, alloc_count),
+            offset_of!(FreeList, domain_id),
+            offset_of!(FreeList, class),
+            size_of::<Params>(),
+            offset_of!(Params, pool_mask),
+            offset_of!(Params, dealloc_threshold),
+            cfg!(ocaml5) as usize,
+            MULTITHREAD as usize,
+        ];
+        assert_eq!(c, rust);
+    }
+}
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: MIT */
+
+/* Layout of the private definitions of boxroot.h which are mirrored
+   in src/fast_path.rs, as computed by the C compiler.
+
+   This file is compiled with every bundled build, so that the
+   assertions below fail the build as soon as the C definitions drift
+   from the #[repr(C)] definitions of src/fast_path.rs, even on
+   stable Rust where the fast paths are not compiled. The table is
+   also compared against the Rust definitions by the test in
+   src/fast_path.rs. */
+
+#include <stddef.h>
+#include "boxroot.h"
+
+#define PTR sizeof(void *)
+#define INT sizeof(int)
+
+/* union Slot { *mut Slot, Value } */
+_Static_assert(sizeof(bxr_slot) == PTR, "layout of Slot");
+
+/* struct FreeList { *mut Slot, *mut Slot, c_int, c_int, c_int } */
+_Static_assert(offsetof(bxr_free_list, next) == 0, "layout of FreeList");
+_Static_assert(offsetof(bxr_free_list, end) == PTR, "layout of FreeList");
+_Static_assert(offsetof(bxr_free_list, alloc_count) == 2 * PTR,
+               "layout of FreeList");
+_Static_assert(offsetof(bxr_free_list, domain_id) == 2 * PTR + INT,
+               "layout of FreeList");
+_Static_assert(offsetof(bxr_free_list, class) == 2 * PTR + 2 * INT,
+               "layout of FreeList");
+_Static_assert(sizeof(bxr_free_list) == (3 * PTR + 3 * INT - 1) / PTR * PTR,
+               "layout of FreeList");
+
+/* struct Params { usize, c_int } */
+_Static_assert(offsetof(struct bxr_params, pool_mask) == 0,
+               "layout of Params");
+_Static_assert(sizeof(((struct bxr_params *)0)->pool_mask) == PTR,
+               "layout of Params");
+_Static_assert(offsetof(struct bxr_params, dealloc_threshold) == PTR,
+               "layout of Params");
+_Static_assert(sizeof(struct bxr_params) == (2 * PTR + INT - 1) / PTR * PTR,
+               "layout of Params");
+
+/* cfg(ocaml5), when the fast paths are compiled (see build.rs) */
+#ifdef OCAML_BOXROOT_SYS_OCAML5
+_Static_assert(OCAML_MULTICORE == OCAML_BOXROOT_SYS_OCAML5,
+               "cfg(ocaml5) does not match the OCaml headers");
+#endif
+
+const size_t ocaml_boxroot_sys_layout[] = {
+  sizeof(bxr_slot),
+  sizeof(bxr_free_list),
+  offsetof(bxr_free_list, next),
+  offsetof(bxr_free_list, end),
+  offsetof(bxr_free_list, alloc_count),
+  offsetof(bxr_free_list, domain_id),
+  offsetof(bxr_free_list, class),
+  sizeof(struct bxr_params),
+  offsetof(struct bxr_params, pool_mask),
+  offsetof(struct bxr_params, dealloc_threshold),
+  OCAML_MULTICORE,
+  BXR_MULTITHREAD,
+};
@@ -4,6 +4,10 @@
 #![cfg_attr(
     not(test),
     no_std)]
+#![cfg_attr(all(feature = "inline-fast-paths", nightly), feature(thread_local))]
+
+#[cfg(all(feature = "inline-fast-paths", not(nightly)))]
+compile_error!("the `inline-fast-paths` feature requires a nightly Rust compiler");
 
 pub type Value = isize;
 pub type ValueCell = core::cell::UnsafeCell<Value>;
@@ -12,6 +16,21 @@ pub type ValueCell = core::cell::UnsafeCell<Value>;
 #[derive(Copy, Clone, Debug, PartialEq, PartialOrd, Eq)]
 pub struct BoxRoot { contents: core::ptr::NonNull<ValueCell> }
 
+// With the `single-threaded` feature, the C library is the
+// single-threaded build, whose symbols are prefixed with `st_` (see
+// boxroot/boxroot.h).
+macro_rules! boxroot_extern {
+    ($(pub fn $name:ident($($arg:ident: $ty:ty),* $(,)?) $(-> $ret:ty)?;)*) => {
+        extern "C" {
+            $(
+                #[cfg_attr(feature = "single-threaded",
+                           link_name = concat!("st_", stringify!($name)))]
+                pub fn $name($($arg: $ty),*) $(-> $ret)?;
+            )*
+        }
+    };
+}
+
 /// Documentation inside boxroot/boxroot.h (including rules for safe usage)
 
 #[inline]
@@ -24,12 +43,116 @@ pub unsafe fn boxroot_get(br: BoxRoot) -> Value {
     *(core::cell::UnsafeCell::raw_get(boxroot_get_ref(br)))
 }
 
-extern "C" {
+// With the `inline-fast-paths` feature, the fast paths of
+// `boxroot_create`, `boxroot_delete` and `boxroot_modify` are
+// inlined in Rust code, as they are in C (see src/fast_path.rs).
+#[cfg(all(feature = "inline-fast-paths", nightly))]
+mod fast_path;
+#[cfg(all(feature = "inline-fast-paths", nightly))]
+pub use fast_path::{boxroot_create, boxroot_delete, boxroot_modify};
+
+#[cfg(not(all(feature = "inline-fast-paths", nightly)))]
+boxroot_extern! {
     pub fn boxroot_create(v: Value) -> Option<BoxRoot>;
     pub fn boxroot_delete(br: BoxRoot);
     pub fn boxroot_modify(br: *mut BoxRoot, v: Value) -> bool;
 }
 
+boxroot_extern! {
+    pub fn boxroot_migrate(br: *mut BoxRoot) -> bool;
+    pub fn boxroot_reserve(n: usize) -> bool;
+    pub fn boxroot_set_memory_limits(
+        soft: usize,
+        hard: usize,
+        cb: Option<extern "C" fn(usize)>,
+    );
+}
+
+boxroot_extern! {
+    pub fn boxroot_create_many(vs: *const Value, rs: *mut BoxRoot, n: usize) -> bool;
+    pub fn boxroot_delete_many(rs: *const BoxRoot, n: usize);
+}
+
+// Slice versions of `boxroot_create_many` and `boxroot_delete_many`,
+// e.g. for the spare capacity of a `Vec<BoxRoot>` and for its
+// contents when it is dropped. On success, every element of `rs` is
+// initialised.
+#[inline]
+pub unsafe fn boxroot_create_slice(
+    vs: &[Value],
+    rs: &mut [core::mem::MaybeUninit<BoxRoot>],
+) -> bool {
+    assert_eq!(vs.len(), rs.len());
+    boxroot_create_many(vs.as_ptr(), rs.as_mut_ptr() as *mut BoxRoot, vs.len())
+}
+
+#[inline]
+pub unsafe fn boxroot_delete_slice(rs: &[BoxRoot]) {
+    boxroot_delete_many(rs.as_ptr(), rs.len())
+}
+
+#[repr(C)]
+pub struct BoxRootWeak { _private: [u8; 0] }
+
+pub const BOXROOT_WEAK_EMPTY: Value = 0;
+
+boxroot_extern! {
+    pub fn boxroot_weak_create(v: Value) -> *mut BoxRootWeak;
+    pub fn boxroot_weak_get(w: *mut BoxRootWeak) -> Value;
+    pub fn boxroot_weak_delete(w: *mut BoxRootWeak);
+}
+
+#[repr(C)]
+pub struct BoxRootPermanent { _private: [u8; 0] }
+
+boxroot_extern! {
+    pub fn boxroot_create_permanent(v: Value) -> *mut BoxRootPermanent;
+    pub fn boxroot_permanent_get(r: *mut BoxRootPermanent) -> Value;
+}
+
+pub type BoxRootCompact = u32;
+
+boxroot_extern! {
+    pub fn boxroot_compact_create(v: Value) -> BoxRootCompact;
+    pub fn boxroot_compact_get(h: BoxRootCompact) -> Value;
+    pub fn boxroot_compact_get_ref(h: BoxRootCompact) -> *const ValueCell;
+    pub fn boxroot_compact_delete(h: BoxRootCompact);
+    pub fn boxroot_compact_modify(h: *mut BoxRootCompact, v: Value) -> bool;
+}
+
+#[repr(C)]
+pub struct BoxRootGroup { _private: [u8; 0] }
+
+boxroot_extern! {
+    pub fn boxroot_group_create() -> *mut BoxRootGroup;
+    pub fn boxroot_create_in(g: *mut BoxRootGroup, v: Value) -> Option<BoxRoot>;
+    pub fn boxroot_group_release(g: *mut BoxRootGroup);
+}
+
+#[repr(C)]
+pub struct BoxRootArray { _private: [u8; 0] }
+
+boxroot_extern! {
+    pub fn boxroot_array_create(n: usize) -> *mut BoxRootArray;
+    pub fn boxroot_array_size(a: *mut BoxRootArray) -> usize;
+    pub fn boxroot_array_get(a: *mut BoxRootArray, i: usize) -> Value;
+    pub fn boxroot_array_get_ref(a: *mut BoxRootArray, i: usize) -> *const ValueCell;
+    pub fn boxroot_array_set(a: *mut BoxRootArray, i: usize, v: Value) -> bool;
+    pub fn boxroot_array_resize(a: *mut *mut BoxRootArray, n: usize) -> bool;
+    pub fn boxroot_array_delete(a: *mut BoxRootArray);
+}
+
+#[repr(C)]
+pub struct BoxRootCell { contents: ValueCell, slot: usize }
+
+boxroot_extern! {
+    pub fn boxroot_cell_register(c: *mut BoxRootCell, v: Value) -> bool;
+    pub fn boxroot_cell_get(c: *const BoxRootCell) -> Value;
+    pub fn boxroot_cell_get_ref(c: *const BoxRootCell) -> *const ValueCell;
+    pub fn boxroot_cell_set(c: *mut BoxRootCell, v: Value) -> bool;
+    pub fn boxroot_cell_unregister(c: *mut BoxRootCell);
+}
+
 #[repr(C)]
 #[non_exhaustive]
 pub enum Status {
@@ -39,7 +162,19 @@ pub enum Status {
   Invalid
 }
 
-extern "C" {
+#[repr(C)]
+pub enum Param {
+  PoolLogSize,
+  DeallocThreshold,
+  LowWaterPercent,
+  RetainMinPools,
+  RetainMaxPools,
+  RetainDecay,
+  YoungPoolLogSize
+}
+
+boxroot_extern! {
+    pub fn boxroot_configure(param: Param, n: core::ffi::c_long) -> bool;
     pub fn boxroot_teardown();
     pub fn boxroot_status() -> Status;
     pub fn boxroot_print_stats();